@@ -95,24 +95,30 @@ IOTHUBMESSAGE_DISPOSITION_RESULT messageCallback(IoTHubDevice &iotHubDevice, IoT
 }
 
 // Message acknowledgement callback
-void eventConfirmationCallback(IoTHubDevice &iotHubDevice, IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *userContext)
+void eventConfirmationCallback(IoTHubDevice &iotHubDevice, IoTHubDevice::ConfirmationResult result, void *userContext)
 {
   Serial.print("Message response - ");
 
   switch (result)
   {
-    case IOTHUB_CLIENT_CONFIRMATION_OK:
+    case IoTHubDevice::ConfirmationOk:
       Serial.println("OK");
       break;
-    case IOTHUB_CLIENT_CONFIRMATION_BECAUSE_DESTROY:
+    case IoTHubDevice::ConfirmationBecauseDestroy:
       Serial.println("Because destroy");
       break;
-    case IOTHUB_CLIENT_CONFIRMATION_MESSAGE_TIMEOUT:
+    case IoTHubDevice::ConfirmationMessageTimeout:
       Serial.println("Timeout");
       break;
-    case IOTHUB_CLIENT_CONFIRMATION_ERROR:
+    case IoTHubDevice::ConfirmationError:
       Serial.println("Error");
       break;
+    case IoTHubDevice::ConfirmationExpired:
+      Serial.println("Expired before it could be sent");
+      break;
+    case IoTHubDevice::ConfirmationDropped:
+      Serial.println("Dropped from full queue");
+      break;
     default:
       Serial.println("Warning: unknown result");
       break;
@@ -375,6 +381,9 @@ void setup()
   deviceHandle = new IoTHubDevice(CONNECTIONSTRING, IoTHubDevice::Protocol::MQTT);
 #endif
 
+  // Configure from the last device twin received rather than the compiled in defaults until the hub responds
+  deviceHandle->SetTwinCacheFile("/spiffs/twin.json");
+
   if (0 != deviceHandle->Start())
   {
     Serial.println("Failed to start IoT device");
@@ -395,6 +404,10 @@ void setup()
   deviceHandle->SetUnknownDeviceMethodCallback(unknownDeviceMethodCallback, NULL);
   deviceHandle->SetDeviceTwinCallback(deviceTwinCallback, NULL);
 
+  // Readings older than a minute are of no use so discard them rather than send them late
+  deviceHandle->SetMessageTimeToLive(60 * 1000);
+  deviceHandle->SetMaxPendingEvents(5, IoTHubDevice::OverflowPolicy::DropOldest);
+
   // Set logging state
   bool logging = false;
   deviceHandle->SetLogging(logging);
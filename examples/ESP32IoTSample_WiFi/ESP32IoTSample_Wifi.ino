@@ -7,10 +7,14 @@
 //#define X509TEST
 
 #include <SPIFFS.h>
+#include <esp_attr.h>
 
 #include <IoTHubDevice.h>
 #include <IoTHubMessage.h>
 #include <MapUtil.h>
+#include <MessageRouter.h>
+#include <TelemetryAggregator.h>
+#include <TraceBuffer.h>
 #include <parson.h>
 
 #define SSID "<Your Wi-Fi SSID>"
@@ -42,16 +46,36 @@ bool KillWiFi = false;
 // Used to monitor network status
 bool CheckWiFi = false;
 
+// Start up timings are printed once after the first message is confirmed
+bool StartupProfileShown = false;
+
+// Wrapper trace - not initialized on a reset so the records leading up to a crash can be dumped after the restart
+__NOINIT_ATTR TraceBuffer trace;
+
 // LED that is flashed each time a message is sent - you may need to change this
 static const int LED = 13;
 
 // IoT Hub
 IoTHubDevice *deviceHandle = NULL;
 
+// Summarises the Wi-Fi signal strength into one message a minute - window and deadband can be changed from the device twin
+TelemetryAggregator *aggregator = NULL;
+
+// Passes cloud to device messages to a callback chosen by their "type" property
+MessageRouter *router = NULL;
+
 // Message rate per minute - this example is limited to a maximum of 60 due to the manner in which it is timed 
 static const int MESSAGESPERMIN = 20;
 static int currentMessagesPerMinute = MESSAGESPERMIN;
 
+// Called for messages with a "type" property of "ping"
+IOTHUBMESSAGE_DISPOSITION_RESULT pingMessageCallback(IoTHubDevice &iotHubDevice, IoTHubMessage &iotHubMessage, void *userContext)
+{
+  Serial.println("Ping received");
+
+  return IOTHUBMESSAGE_ACCEPTED;
+}
+
 // Message received callback
 IOTHUBMESSAGE_DISPOSITION_RESULT messageCallback(IoTHubDevice &iotHubDevice, IoTHubMessage &iotHubMessage, void *userContext)
 {
@@ -105,24 +129,44 @@ IOTHUBMESSAGE_DISPOSITION_RESULT messageCallback(IoTHubDevice &iotHubDevice, IoT
 }
 
 // Message acknowledgement callback
-void eventConfirmationCallback(IoTHubDevice &iotHubDevice, IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *userContext)
+void eventConfirmationCallback(IoTHubDevice &iotHubDevice, IoTHubDevice::ConfirmationResult result, void *userContext)
 {
   Serial.print("Message response - ");
 
   switch (result)
   {
-    case IOTHUB_CLIENT_CONFIRMATION_OK:
+    case IoTHubDevice::ConfirmationOk:
       Serial.println("OK");
+
+      // Show how long start up took once, when the first message has been confirmed
+      if (!StartupProfileShown)
+      {
+        char profile[640];
+
+        if (iotHubDevice.FormatStartupProfile(profile, sizeof(profile)) > 0)
+        {
+          Serial.print("Startup profile: ");
+          Serial.println(profile);
+        }
+
+        StartupProfileShown = true;
+      }
       break;
-    case IOTHUB_CLIENT_CONFIRMATION_BECAUSE_DESTROY:
+    case IoTHubDevice::ConfirmationBecauseDestroy:
       Serial.println("Because destroy");
       break;
-    case IOTHUB_CLIENT_CONFIRMATION_MESSAGE_TIMEOUT:
+    case IoTHubDevice::ConfirmationMessageTimeout:
       Serial.println("Timeout");
       break;
-    case IOTHUB_CLIENT_CONFIRMATION_ERROR:
+    case IoTHubDevice::ConfirmationError:
       Serial.println("Error");
       break;
+    case IoTHubDevice::ConfirmationExpired:
+      Serial.println("Expired before it could be sent");
+      break;
+    case IoTHubDevice::ConfirmationDropped:
+      Serial.println("Dropped from full queue");
+      break;
     default:
       Serial.println("Warning: unknown result");
       break;
@@ -225,6 +269,11 @@ int unknownDeviceMethodCallback(IoTHubDevice &iotHubDevice, const char *methodNa
 void deviceTwinCallback(DEVICE_TWIN_UPDATE_STATE update_state, const char* payLoad, void* userContext)
 {
   Serial.printf("Device Twin Callback: update_state=%S;payLoad=\r\n%s\r\n", ((update_state == DEVICE_TWIN_UPDATE_COMPLETE)? "Update Complete" : "Update Partial"), payLoad);
+  if (aggregator != NULL)
+  {
+    aggregator->ApplyDeviceTwin(update_state, payLoad);
+  }
+
   JSON_Value *root_value = NULL;
   JSON_Object *root_object = NULL;
   JSON_Value* desired_messagePerMinute;
@@ -351,6 +400,12 @@ uint8_t *readFile(const char *filename)
   return filecontent;
 }
 
+// Writes trace dumps to serial - decode them with extras/host/trace_decode
+void traceWriter(const char *text, void *userContext)
+{
+  Serial.print(text);
+}
+
 // Called when a terminal error occurs
 void errorSpin()
 {
@@ -372,6 +427,13 @@ void setup()
   Serial.begin(115200);
   Serial.setDebugOutput(true);
   Serial.println("Starting");
+
+  if (trace.Begin())
+  {
+    Serial.println("Trace from before the reset:");
+    trace.Dump(traceWriter);
+  }
+
   pinMode(LED, OUTPUT);
   digitalWrite(LED, LOW);
   initWiFi();
@@ -398,6 +460,12 @@ void setup()
   deviceHandle = new IoTHubDevice(CONNECTIONSTRING, IoTHubDevice::Protocol::MQTT);
 #endif
 
+  // Configure from the last device twin received rather than the compiled in defaults until the hub responds
+  deviceHandle->SetTwinCacheFile("/spiffs/twin.json");
+
+  // Cheap enough to leave on, unlike SetLogging which slows the device down
+  deviceHandle->SetTraceBuffer(&trace);
+
   if (0 != deviceHandle->Start())
   {
     Serial.println("Failed to start IoT device");
@@ -411,13 +479,26 @@ void setup()
   Serial.print("Device ID = ");
   Serial.println(deviceHandle->GetDeviceId());
 
+  // One minute tumbling window, changes in signal strength of less than 2dBm are ignored. Created before the
+  // device twin callback is set as the cached twin may be applied to it from the first DoWork
+  aggregator = new TelemetryAggregator(*deviceHandle, 60 * 1000);
+  aggregator->AddSignal("rssi", 2);
+  aggregator->SetEventConfirmationCallback(eventConfirmationCallback, NULL);
+
   // Set up event callbacks
-  deviceHandle->SetMessageCallback(messageCallback, NULL);
+  router = new MessageRouter(*deviceHandle);
+  router->AddRoute("type", "ping", pingMessageCallback);
+  router->SetDefaultRoute(messageCallback);
   deviceHandle->SetConnectionStatusCallback(connectionStatusCallback, NULL);
   deviceHandle->SetDeviceMethodCallback("Test", deviceMethodCallback_Test, NULL);
+  deviceHandle->SetDeviceMethodCallback("trace", TraceBuffer::DeviceMethodCallback, &trace);
   deviceHandle->SetUnknownDeviceMethodCallback(unknownDeviceMethodCallback, NULL);
   deviceHandle->SetDeviceTwinCallback(deviceTwinCallback, NULL);
 
+  // Readings older than a minute are of no use so discard them rather than send them late
+  deviceHandle->SetMessageTimeToLive(60 * 1000);
+  deviceHandle->SetMaxPendingEvents(5, IoTHubDevice::OverflowPolicy::DropOldest);
+
   // Set logging state
   bool logging = false;
   deviceHandle->SetLogging(logging);
@@ -429,6 +510,7 @@ void setup()
 void loop() 
 {
   time_t last = 0;
+  time_t lastSample = 0;
   time_t now;
   IOTHUB_CLIENT_RESULT result;
   int ledOffIn = 0;
@@ -500,7 +582,15 @@ void loop()
       last = now;
     }
 
+    // Sample once a second and leave it to the aggregator to decide what gets sent
+    if (now != lastSample)
+    {
+      aggregator->AddSample("rssi", WiFi.RSSI());
+      lastSample = now;
+    }
+
     // Must call DoWork very frequently
+    aggregator->DoWork();
     deviceHandle->DoWork();
     delay(10);
   }
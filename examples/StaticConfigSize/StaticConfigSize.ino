@@ -0,0 +1,69 @@
+// Minimal sketch for comparing flash and RAM use between the default and IOTHUB_STATIC_CONFIG builds. It only
+// connects and sends a message every ten seconds so that the size summary is mostly the wrapper and the SDK.
+// Builds for the ESP8266 and the ESP32, see "Static configuration" in the library README.
+
+#ifdef ESP8266
+#include <ESP8266WiFi.h>
+#else
+#include <AzureIoTSocket_WiFi.h>
+#endif
+
+#include <time.h>
+
+#include <IoTHubDevice.h>
+
+static const char *SSID = "<Your SSID here>";
+static const char *PASSWORD = "<Your Wi-Fi password here>";
+static const char *CONNECTIONSTRING = "<Regular connection string>";
+
+// Declared statically so that the fixed size containers show up in the global variable figure
+IoTHubDevice device(CONNECTIONSTRING);
+
+static unsigned long lastSend = 0;
+
+void eventConfirmationCallback(IoTHubDevice &iotHubDevice, IoTHubDevice::ConfirmationResult result, void *userContext)
+{
+  Serial.print("Message response - ");
+  Serial.println((int)result);
+}
+
+void setup()
+{
+  Serial.begin(115200);
+
+  WiFi.begin(SSID, PASSWORD);
+  while (WiFi.status() != WL_CONNECTED)
+  {
+    Serial.print(".");
+    delay(500);
+  }
+  Serial.println();
+
+  // SAS tokens need the correct time
+  configTime(0, 0, "pool.ntp.org", "time.nist.gov");
+  while (time(NULL) < 1000000000)
+  {
+    delay(500);
+  }
+
+  if (0 != device.Start())
+  {
+    Serial.println("Failed to start IoT device");
+  }
+}
+
+void loop()
+{
+  if (millis() - lastSend >= 10000)
+  {
+    lastSend = millis();
+
+    if (IOTHUB_CLIENT_OK != device.SendEventAsync("{\"alive\":true}", eventConfirmationCallback))
+    {
+      Serial.println("Failed to send message");
+    }
+  }
+
+  device.DoWork();
+  delay(10);
+}
@@ -0,0 +1,511 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include "AzureIoTHub.h"
+#include "AzureIoTProtocol_MQTT.h"
+#include "FakeHub.h"
+
+static FakeHub::Config config;
+static FakeHub::Stats stats;
+static bool inDoWork = false;
+
+static unsigned long Now()
+{
+    return (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Something the hub will send back once dueAt has passed
+struct Acknowledgement
+{
+    unsigned long dueAt;
+    IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK eventConfirmationCallback;
+    IOTHUB_CLIENT_REPORTED_STATE_CALLBACK reportedStateCallback;
+    void *userContext;
+};
+
+struct Client
+{
+    IOTHUB_CLIENT_MESSAGE_CALLBACK_ASYNC messageCallback;
+    void *messageUserContext;
+    IOTHUB_CLIENT_CONNECTION_STATUS_CALLBACK connectionStatusCallback;
+    void *connectionStatusUserContext;
+    IOTHUB_CLIENT_DEVICE_TWIN_CALLBACK deviceTwinCallback;
+    void *deviceTwinUserContext;
+    IOTHUB_CLIENT_DEVICE_METHOD_CALLBACK_ASYNC deviceMethodCallback;
+    void *deviceMethodUserContext;
+    IOTHUB_CLIENT_RETRY_POLICY retryPolicy;
+    size_t retryTimeout;
+    bool connected;
+    bool sasTokenExpired;
+    unsigned long disconnectedAt;
+    unsigned long uplinkFreeAt;             // When everything published so far will have been sent
+    unsigned long twinDueAt;                // 0 if no request is outstanding
+    unsigned long queuedDueAt;
+    unsigned int queuedMessages;
+    unsigned int queuedMethods;
+    std::vector<Acknowledgement> acknowledgements;
+};
+
+// Handles given out are looked up here rather than being pointers to a struct of the SDK's name for the
+// client, which is IOTHUB_CLIENT_CORE_LL_HANDLE_DATA_TAG in current SDKs and was
+// IOTHUB_CLIENT_LL_HANDLE_DATA_TAG in older ones
+static std::map<IOTHUB_CLIENT_LL_HANDLE, Client *> clients;
+
+static Client *GetClient(IOTHUB_CLIENT_LL_HANDLE handle)
+{
+    std::map<IOTHUB_CLIENT_LL_HANDLE, Client *>::iterator it = clients.find(handle);
+
+    return (it == clients.end()) ? NULL : it->second;
+}
+
+// Queues bytes on the uplink and returns when the last of them will have been sent
+static unsigned long Transmit(Client *client, size_t size)
+{
+    unsigned long now = Now();
+
+    if (client->uplinkFreeAt < now)
+    {
+        client->uplinkFreeAt = now;
+    }
+
+    if (config.bytesPerSecond != 0)
+    {
+        client->uplinkFreeAt += (unsigned long)(size * 1000 / config.bytesPerSecond);
+    }
+
+    stats.wireBytesSent += size;
+
+    return client->uplinkFreeAt;
+}
+
+static void RequestTwin(Client *client)
+{
+    client->twinDueAt = Transmit(client, config.publishOverhead) + config.roundTripTime;
+}
+
+static void Connect(Client *client)
+{
+    // The real client blocks in DoWork for the handshake
+    std::this_thread::sleep_for(std::chrono::milliseconds(config.connectTime));
+
+    client->connected = true;
+    client->uplinkFreeAt = Now();
+    client->queuedDueAt = client->uplinkFreeAt + config.roundTripTime;
+    stats.connects++;
+    stats.wireBytesSent += config.connectBytesSent;
+    stats.wireBytesReceived += config.connectBytesReceived;
+
+    if (client->connectionStatusCallback != NULL)
+    {
+        client->connectionStatusCallback(IOTHUB_CLIENT_CONNECTION_AUTHENTICATED, IOTHUB_CLIENT_CONNECTION_OK, client->connectionStatusUserContext);
+    }
+
+    if (client->deviceTwinCallback != NULL)
+    {
+        RequestTwin(client);
+    }
+}
+
+static void DeliverQueued(Client *client)
+{
+    char payload[64];
+
+    while (client->queuedMessages > 0 && client->messageCallback != NULL)
+    {
+        IOTHUB_MESSAGE_HANDLE message;
+
+        snprintf(payload, sizeof(payload), "{\"fakeMessage\":%u}", client->queuedMessages--);
+        message = IoTHubMessage_CreateFromString(payload);
+        stats.wireBytesReceived += strlen(payload) + config.publishOverhead;
+
+        if (message != NULL)
+        {
+            (void)IoTHubMessage_SetProperty(message, "type", "fake");
+            (void)client->messageCallback(message, client->messageUserContext);
+            IoTHubMessage_Destroy(message);
+        }
+
+        Transmit(client, config.acknowledgementSize);
+    }
+
+    while (client->queuedMethods > 0 && client->deviceMethodCallback != NULL)
+    {
+        unsigned char *response = NULL;
+        size_t responseSize = 0;
+
+        snprintf(payload, sizeof(payload), "{\"fakeMethod\":%u}", client->queuedMethods--);
+        stats.wireBytesReceived += strlen(payload) + config.publishOverhead;
+        (void)client->deviceMethodCallback(config.methodName, (const unsigned char *)payload, strlen(payload), &response, &responseSize, client->deviceMethodUserContext);
+        Transmit(client, responseSize + config.publishOverhead);
+        free(response);
+    }
+}
+
+extern "C"
+{
+
+const TRANSPORT_PROVIDER *MQTT_Protocol(void)
+{
+    return NULL;
+}
+
+const char *IoTHubClient_GetVersionString(void)
+{
+    return "FakeHub";
+}
+
+IOTHUB_CLIENT_LL_HANDLE IoTHubClient_LL_CreateFromConnectionString(const char *connectionString, IOTHUB_CLIENT_TRANSPORT_PROVIDER protocol)
+{
+    IOTHUB_CLIENT_LL_HANDLE handle = NULL;
+
+    if (connectionString != NULL)
+    {
+        Client *client = new Client();
+
+        client->retryPolicy = IOTHUB_CLIENT_RETRY_EXPONENTIAL_BACKOFF_WITH_JITTER;
+        client->queuedMessages = config.queuedMessages;
+        client->queuedMethods = config.queuedMethods;
+        handle = (IOTHUB_CLIENT_LL_HANDLE)client;
+        clients[handle] = client;
+    }
+
+    return handle;
+}
+
+void IoTHubClient_LL_Destroy(IOTHUB_CLIENT_LL_HANDLE handle)
+{
+    Client *client = GetClient(handle);
+
+    if (client != NULL)
+    {
+        for (size_t i = 0; i < client->acknowledgements.size(); i++)
+        {
+            Acknowledgement &acknowledgement = client->acknowledgements[i];
+
+            // Like the SDK, reported state updates are dropped without a callback
+            if (acknowledgement.eventConfirmationCallback != NULL)
+            {
+                acknowledgement.eventConfirmationCallback(IOTHUB_CLIENT_CONFIRMATION_BECAUSE_DESTROY, acknowledgement.userContext);
+            }
+        }
+
+        clients.erase(handle);
+        delete client;
+    }
+}
+
+IOTHUB_CLIENT_RESULT IoTHubClient_LL_SendEventAsync(IOTHUB_CLIENT_LL_HANDLE handle, IOTHUB_MESSAGE_HANDLE eventMessageHandle, IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK eventConfirmationCallback, void *userContextCallback)
+{
+    Client *client = GetClient(handle);
+    IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_OK;
+    const unsigned char *buffer;
+    size_t size = 0;
+
+    if (client == NULL || eventMessageHandle == NULL)
+    {
+        result = IOTHUB_CLIENT_INVALID_ARG;
+    }
+    else
+    {
+        if (IoTHubMessage_GetContentType(eventMessageHandle) == IOTHUBMESSAGE_BYTEARRAY)
+        {
+            (void)IoTHubMessage_GetByteArray(eventMessageHandle, &buffer, &size);
+        }
+        else if (IoTHubMessage_GetString(eventMessageHandle) != NULL)
+        {
+            size = strlen(IoTHubMessage_GetString(eventMessageHandle));
+        }
+
+        Acknowledgement acknowledgement = { Transmit(client, size + config.publishOverhead) + config.roundTripTime, eventConfirmationCallback, NULL, userContextCallback };
+
+        client->acknowledgements.push_back(acknowledgement);
+        stats.publishes++;
+    }
+
+    return result;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubClient_LL_SendReportedState(IOTHUB_CLIENT_LL_HANDLE handle, const unsigned char *reportedState, size_t size, IOTHUB_CLIENT_REPORTED_STATE_CALLBACK reportedStateCallback, void *userContextCallback)
+{
+    Client *client = GetClient(handle);
+    IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_OK;
+
+    if (client == NULL || reportedState == NULL)
+    {
+        result = IOTHUB_CLIENT_INVALID_ARG;
+    }
+    else
+    {
+        Acknowledgement acknowledgement = { Transmit(client, size + config.publishOverhead) + config.roundTripTime, NULL, reportedStateCallback, userContextCallback };
+
+        client->acknowledgements.push_back(acknowledgement);
+        stats.publishes++;
+    }
+
+    return result;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubClient_LL_GetSendStatus(IOTHUB_CLIENT_LL_HANDLE handle, IOTHUB_CLIENT_STATUS *iotHubClientStatus)
+{
+    Client *client = GetClient(handle);
+    IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_OK;
+
+    if (client == NULL || iotHubClientStatus == NULL)
+    {
+        result = IOTHUB_CLIENT_INVALID_ARG;
+    }
+    else
+    {
+        *iotHubClientStatus = client->acknowledgements.empty() ? IOTHUB_CLIENT_SEND_STATUS_IDLE : IOTHUB_CLIENT_SEND_STATUS_BUSY;
+    }
+
+    return result;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubClient_LL_SetMessageCallback(IOTHUB_CLIENT_LL_HANDLE handle, IOTHUB_CLIENT_MESSAGE_CALLBACK_ASYNC messageCallback, void *userContextCallback)
+{
+    Client *client = GetClient(handle);
+    IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_OK;
+
+    if (client == NULL)
+    {
+        result = IOTHUB_CLIENT_INVALID_ARG;
+    }
+    else
+    {
+        client->messageCallback = messageCallback;
+        client->messageUserContext = userContextCallback;
+    }
+
+    return result;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubClient_LL_SetConnectionStatusCallback(IOTHUB_CLIENT_LL_HANDLE handle, IOTHUB_CLIENT_CONNECTION_STATUS_CALLBACK connectionStatusCallback, void *userContextCallback)
+{
+    Client *client = GetClient(handle);
+    IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_OK;
+
+    if (client == NULL)
+    {
+        result = IOTHUB_CLIENT_INVALID_ARG;
+    }
+    else
+    {
+        client->connectionStatusCallback = connectionStatusCallback;
+        client->connectionStatusUserContext = userContextCallback;
+    }
+
+    return result;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubClient_LL_SetRetryPolicy(IOTHUB_CLIENT_LL_HANDLE handle, IOTHUB_CLIENT_RETRY_POLICY retryPolicy, size_t retryTimeoutLimitInSeconds)
+{
+    Client *client = GetClient(handle);
+    IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_OK;
+
+    if (client == NULL)
+    {
+        result = IOTHUB_CLIENT_INVALID_ARG;
+    }
+    else
+    {
+        client->retryPolicy = retryPolicy;
+        client->retryTimeout = retryTimeoutLimitInSeconds;
+
+        if (inDoWork)
+        {
+            stats.retryPolicyChangesInDoWork++;
+        }
+    }
+
+    return result;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubClient_LL_GetRetryPolicy(IOTHUB_CLIENT_LL_HANDLE handle, IOTHUB_CLIENT_RETRY_POLICY *retryPolicy, size_t *retryTimeoutLimitInSeconds)
+{
+    Client *client = GetClient(handle);
+    IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_OK;
+
+    if (client == NULL || retryPolicy == NULL || retryTimeoutLimitInSeconds == NULL)
+    {
+        result = IOTHUB_CLIENT_INVALID_ARG;
+    }
+    else
+    {
+        *retryPolicy = client->retryPolicy;
+        *retryTimeoutLimitInSeconds = client->retryTimeout;
+    }
+
+    return result;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubClient_LL_SetOption(IOTHUB_CLIENT_LL_HANDLE handle, const char *optionName, const void *value)
+{
+    Client *client = GetClient(handle);
+
+    return (client == NULL || optionName == NULL) ? IOTHUB_CLIENT_INVALID_ARG : IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubClient_LL_SetDeviceTwinCallback(IOTHUB_CLIENT_LL_HANDLE handle, IOTHUB_CLIENT_DEVICE_TWIN_CALLBACK deviceTwinCallback, void *userContextCallback)
+{
+    Client *client = GetClient(handle);
+    IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_OK;
+
+    if (client == NULL)
+    {
+        result = IOTHUB_CLIENT_INVALID_ARG;
+    }
+    else
+    {
+        client->deviceTwinCallback = deviceTwinCallback;
+        client->deviceTwinUserContext = userContextCallback;
+
+        if (client->connected && deviceTwinCallback != NULL)
+        {
+            RequestTwin(client);
+        }
+    }
+
+    return result;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubClient_LL_SetDeviceMethodCallback(IOTHUB_CLIENT_LL_HANDLE handle, IOTHUB_CLIENT_DEVICE_METHOD_CALLBACK_ASYNC deviceMethodCallback, void *userContextCallback)
+{
+    Client *client = GetClient(handle);
+    IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_OK;
+
+    if (client == NULL)
+    {
+        result = IOTHUB_CLIENT_INVALID_ARG;
+    }
+    else
+    {
+        client->deviceMethodCallback = deviceMethodCallback;
+        client->deviceMethodUserContext = userContextCallback;
+    }
+
+    return result;
+}
+
+static void DoWork(Client *client)
+{
+    std::vector<Acknowledgement> due;
+    unsigned long now = Now();
+
+    if (client->connected && client->sasTokenExpired)
+    {
+        client->connected = false;
+        client->sasTokenExpired = false;
+        client->disconnectedAt = now;
+
+        if (client->connectionStatusCallback != NULL)
+        {
+            client->connectionStatusCallback(IOTHUB_CLIENT_CONNECTION_UNAUTHENTICATED, IOTHUB_CLIENT_CONNECTION_EXPIRED_SAS_TOKEN, client->connectionStatusUserContext);
+        }
+
+        return;
+    }
+
+    // The retry policy is read when the reconnect is due, as the SDK does
+    if (!client->connected)
+    {
+        if (client->disconnectedAt != 0 && client->retryPolicy != IOTHUB_CLIENT_RETRY_IMMEDIATE && now - client->disconnectedAt < config.retryDelay)
+        {
+            return;
+        }
+
+        Connect(client);
+        now = Now();
+    }
+
+    // Taken out first as the callbacks may publish more
+    for (size_t i = 0; i < client->acknowledgements.size();)
+    {
+        if (client->acknowledgements[i].dueAt <= now)
+        {
+            due.push_back(client->acknowledgements[i]);
+            client->acknowledgements.erase(client->acknowledgements.begin() + i);
+        }
+        else
+        {
+            i++;
+        }
+    }
+
+    for (size_t i = 0; i < due.size(); i++)
+    {
+        stats.wireBytesReceived += config.acknowledgementSize;
+
+        if (due[i].eventConfirmationCallback != NULL)
+        {
+            due[i].eventConfirmationCallback(IOTHUB_CLIENT_CONFIRMATION_OK, due[i].userContext);
+        }
+        else if (due[i].reportedStateCallback != NULL)
+        {
+            due[i].reportedStateCallback(204, due[i].userContext);
+        }
+    }
+
+    if (client->twinDueAt != 0 && client->twinDueAt <= now)
+    {
+        client->twinDueAt = 0;
+        stats.wireBytesReceived += strlen(config.twin) + config.publishOverhead;
+
+        if (client->deviceTwinCallback != NULL)
+        {
+            client->deviceTwinCallback(DEVICE_TWIN_UPDATE_COMPLETE, (const unsigned char *)config.twin, strlen(config.twin), client->deviceTwinUserContext);
+        }
+    }
+
+    if (client->queuedDueAt <= now)
+    {
+        DeliverQueued(client);
+    }
+}
+
+void IoTHubClient_LL_DoWork(IOTHUB_CLIENT_LL_HANDLE handle)
+{
+    Client *client = GetClient(handle);
+
+    if (client != NULL)
+    {
+        inDoWork = true;
+        DoWork(client);
+        inDoWork = false;
+    }
+}
+
+}
+
+void FakeHub::Configure(const Config &newConfig)
+{
+    config = newConfig;
+}
+
+const FakeHub::Config &FakeHub::GetConfig()
+{
+    return config;
+}
+
+const FakeHub::Stats &FakeHub::GetStats()
+{
+    return stats;
+}
+
+void FakeHub::ResetStats()
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+void FakeHub::ExpireSasTokens()
+{
+    for (std::map<IOTHUB_CLIENT_LL_HANDLE, Client *>::iterator it = clients.begin(); it != clients.end(); ++it)
+    {
+        it->second->sasTokenExpired = it->second->connected;
+    }
+}
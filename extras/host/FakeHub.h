@@ -0,0 +1,66 @@
+#ifndef _FAKEHUB_H
+#define _FAKEHUB_H
+
+// Stands in for the SDK's low level client (IoTHubClient_LL_*) so that the wrapper can be run on a host
+// against a simulated hub, with no network. Connecting blocks DoWork for a set time, as the real TLS
+// handshake does, publishes are serialised over an uplink of a set rate and each is acknowledged one round
+// trip after it has been sent. Time is real, so the wrapper's own timings are measured as on a device.
+//
+// Link it in place of the SDK's client and MQTT transport libraries.
+class FakeHub
+{
+public:
+    struct Config
+    {
+        unsigned int connectTime;           // ms for name resolution, TCP, TLS and MQTT CONNECT
+        unsigned int roundTripTime;         // ms from the end of a publish to its acknowledgement
+        unsigned long bytesPerSecond;       // Uplink rate, 0 for unlimited
+        unsigned int connectBytesSent;      // TLS handshake and CONNECT, device to hub
+        unsigned int connectBytesReceived;  // TLS handshake including the certificate chain, hub to device
+        unsigned int publishOverhead;       // MQTT header, topic, properties and TLS record per publish
+        unsigned int acknowledgementSize;   // PUBACK in its TLS record
+        unsigned int queuedMessages;        // Cloud to device messages waiting when the device connects
+        unsigned int queuedMethods;         // Device method calls waiting when the device connects
+        unsigned int retryDelay;            // ms before reconnecting under any retry policy but immediate
+        const char *methodName;
+        const char *twin;                   // Sent in full when the device asks for the twin
+
+        Config() :
+            connectTime(1200),
+            roundTripTime(150),
+            bytesPerSecond(12500),
+            connectBytesSent(600),
+            connectBytesReceived(4500),
+            publishOverhead(120),
+            acknowledgementSize(33),
+            queuedMessages(0),
+            queuedMethods(0),
+            retryDelay(5000),
+            methodName("fakeMethod"),
+            twin("{\"desired\":{\"$version\":1},\"reported\":{\"$version\":1}}")
+        {
+        }
+    };
+
+    // Traffic as it would be on the wire, including the overheads above
+    struct Stats
+    {
+        unsigned long connects;
+        unsigned long publishes;
+        unsigned long wireBytesSent;
+        unsigned long wireBytesReceived;
+        unsigned long retryPolicyChangesInDoWork;   // SetRetryPolicy calls made from inside a callback
+    };
+
+    // Applies to clients created afterwards
+    static void Configure(const Config &config);
+    static const Config &GetConfig();
+    static const Stats &GetStats();
+    static void ResetStats();
+
+    // Disconnects every connected client with IOTHUB_CLIENT_CONNECTION_EXPIRED_SAS_TOKEN on its next DoWork,
+    // as the SDK does when it is time to renew the token
+    static void ExpireSasTokens();
+};
+
+#endif // _FAKEHUB_H
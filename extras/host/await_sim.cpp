@@ -0,0 +1,171 @@
+// Runs coroutines that co_await AwaitSendEvent and AwaitReportedState against FakeHub and checks that every
+// await completes with the expected result. The second pass fills the pending queue with DropNewest so
+// that some confirmations arrive from inside the co_await itself, before the coroutine has suspended. The
+// last pass stops the device with a reported state update outstanding.
+// Needs a C++20 compiler:
+//
+//   make build/await_sim && ./build/await_sim
+
+#include <cstdio>
+
+#include "FakeHub.h"
+#include "IoTHubAwaitable.h"
+#include "azure_c_shared_utility/threadapi.h"
+
+#ifndef IOTHUB_HAS_COROUTINES
+#error await_sim needs a C++20 compiler with <coroutine>
+#endif
+
+static const char *ConnectionString = "HostName=fake.azure-devices.net;DeviceId=await;SharedAccessKey=ZmFrZQ==";
+static const unsigned int Timeout = 60000;
+static const int Tasks = 4;
+static const int Readings = 10;
+
+struct Results
+{
+    int confirmed;
+    int dropped;
+    int failed;
+    int reportedStatus;
+};
+
+static IoTHubTask sendReadings(IoTHubDevice &device, int task, Results &results)
+{
+    char payload[64];
+
+    for (int i = 0; i < Readings; i++)
+    {
+        snprintf(payload, sizeof(payload), "{\"task\":%d,\"reading\":%d}", task, i);
+
+        IoTHubDevice::ConfirmationResult confirmation = co_await AwaitSendEvent(device, payload);
+
+        if (confirmation == IoTHubDevice::ConfirmationOk)
+            results.confirmed++;
+        else if (confirmation == IoTHubDevice::ConfirmationDropped)
+            results.dropped++;
+        else
+            results.failed++;
+    }
+
+    results.reportedStatus = co_await AwaitReportedState(device, "{\"readings\":10}");
+}
+
+static IoTHubTask reportState(IoTHubDevice &device, int &status)
+{
+    status = co_await AwaitReportedState(device, "{\"stopping\":true}");
+}
+
+// Starts every task at once so their messages are in flight together, then drives them from DoWork
+static int run(const char *name, size_t maxPendingEvents, int expectedConfirmed)
+{
+    IoTHubDevice device(ConnectionString);
+    Results results[Tasks] = {};
+    IoTHubTask *tasks[Tasks];
+    bool done = false;
+    int confirmed = 0;
+    int dropped = 0;
+    int result = 0;
+
+    device.SetMaxPendingEvents(maxPendingEvents, IoTHubDevice::DropNewest);
+
+    if (device.Start() != 0)
+    {
+        fprintf(stderr, "%s: failed to start\n", name);
+        return 1;
+    }
+
+    for (int i = 0; i < Tasks; i++)
+    {
+        tasks[i] = new IoTHubTask(sendReadings(device, i, results[i]));
+    }
+
+    for (unsigned int elapsed = 0; elapsed < Timeout && !done; elapsed += 10)
+    {
+        device.DoWork();
+        ThreadAPI_Sleep(10);
+
+        done = true;
+
+        for (int i = 0; i < Tasks; i++)
+        {
+            done = done && tasks[i]->Done();
+        }
+    }
+
+    for (int i = 0; i < Tasks; i++)
+    {
+        confirmed += results[i].confirmed;
+        dropped += results[i].dropped;
+
+        if (!tasks[i]->Done() || results[i].failed != 0 || results[i].reportedStatus != 204 ||
+            results[i].confirmed + results[i].dropped != Readings)
+        {
+            fprintf(stderr, "%s: task %d %s, %d confirmed, %d dropped, %d failed, reported state %d\n", name, i,
+                tasks[i]->Done() ? "done" : "not done", results[i].confirmed, results[i].dropped, results[i].failed, results[i].reportedStatus);
+            result = 1;
+        }
+
+        delete tasks[i];
+    }
+
+    if (expectedConfirmed >= 0 && confirmed != expectedConfirmed)
+    {
+        fprintf(stderr, "%s: %d confirmed, expected %d\n", name, confirmed, expectedConfirmed);
+        result = 1;
+    }
+
+    printf("%-10s %9d %9d %s\n", name, confirmed, dropped, result == 0 ? "ok" : "FAILED");
+    device.Stop();
+
+    return result;
+}
+
+// Stops the device while a reported state update is still waiting for the hub, which must resume the await with -1
+static int runStopped(const char *name)
+{
+    IoTHubDevice device(ConnectionString);
+    int status = 0;
+    int result = 0;
+
+    if (device.Start() != 0)
+    {
+        fprintf(stderr, "%s: failed to start\n", name);
+        return 1;
+    }
+
+    // Connect first so the update is on the wire when the device stops
+    device.DoWork();
+
+    IoTHubTask task = reportState(device, status);
+
+    device.Stop();
+
+    if (!task.Done() || status != -1)
+    {
+        fprintf(stderr, "%s: task %s, reported state %d\n", name, task.Done() ? "done" : "not done", status);
+        result = 1;
+    }
+
+    printf("%-10s %9d %9d %s\n", name, 0, 0, result == 0 ? "ok" : "FAILED");
+
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    FakeHub::Config config;
+    int result = 0;
+
+    config.connectTime = 100;
+    config.roundTripTime = 50;
+    config.bytesPerSecond = 0;
+    FakeHub::Configure(config);
+
+    printf("pass       confirmed   dropped\n");
+
+    result |= run("all", Tasks * Readings, Tasks * Readings);
+    result |= run("dropping", 1, -1);
+    result |= runStopped("stopped");
+
+    return result;
+}
@@ -0,0 +1,150 @@
+// Runs IoTHubDevice::RunBurst against FakeHub and prints the radio on time for bursts of different sizes,
+// next to the same readings sent over one connection without burst mode, both with the library default of
+// no limit on messages in flight and one at a time. Each burst also fetches the twin and answers one method
+// and one cloud to device message.
+//
+//   ./build/burst_sim [round trip ms] [uplink bytes per second] [connect ms]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "FakeHub.h"
+#include "IoTHubDevice.h"
+#include "azure_c_shared_utility/threadapi.h"
+
+static const char *ConnectionString = "HostName=fake.azure-devices.net;DeviceId=burst;SharedAccessKey=ZmFrZQ==";
+static const unsigned int Timeout = 120000;
+static const int BurstSizes[] = { 1, 10, 25, 100 };
+
+static IOTHUBMESSAGE_DISPOSITION_RESULT messageCallback(IoTHubDevice &iotHubDevice, IoTHubMessage &iotHubMessage, void *userContext)
+{
+    return IOTHUBMESSAGE_ACCEPTED;
+}
+
+static int deviceMethodCallback(IoTHubDevice &iotHubDevice, const unsigned char *payload, size_t size, unsigned char **response, size_t *resp_size, void *userContext)
+{
+    static const char reply[] = "{\"result\":\"ok\"}";
+
+    *resp_size = sizeof(reply) - 1;
+    *response = (unsigned char *)malloc(*resp_size);
+    memcpy(*response, reply, *resp_size);
+
+    return 200;
+}
+
+static void deviceTwinCallback(DEVICE_TWIN_UPDATE_STATE update_state, const char *payLoad, void *userContext)
+{
+    if (userContext != NULL)
+    {
+        *(bool *)userContext = true;
+    }
+}
+
+// Stands in for readings kept while the radio was off
+static void queueReadings(IoTHubDevice &device, int count)
+{
+    char payload[64];
+
+    for (int i = 0; i < count; i++)
+    {
+        snprintf(payload, sizeof(payload), "{\"reading\":%d,\"temperature\":%.1f}", i, 20.0 + (i % 10) / 10.0);
+        device.SendEventAsync(payload, NULL);
+    }
+}
+
+static void setUp(IoTHubDevice &device)
+{
+    device.SetMessageCallback(messageCallback);
+    device.SetDeviceMethodCallback(FakeHub::GetConfig().methodName, deviceMethodCallback);
+    device.SetDeviceTwinCallback(deviceTwinCallback);
+}
+
+static unsigned long runBurst(int readings, IoTHubDevice::BurstReport &report)
+{
+    IoTHubDevice device(ConnectionString);
+
+    setUp(device);
+    queueReadings(device, readings);
+    report = device.RunBurst(Timeout);
+
+    return report.radioOnTime;
+}
+
+// Without burst mode, stopping once it has all been done. Zero leaves the number in flight unlimited.
+static unsigned long runWithoutBurst(int readings, size_t maxInFlightEvents)
+{
+    IoTHubDevice device(ConnectionString);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bool twinReceived = false;
+
+    setUp(device);
+    device.SetDeviceTwinCallback(deviceTwinCallback, &twinReceived);
+    device.SetMaxInFlightEvents(maxInFlightEvents);
+    queueReadings(device, readings);
+
+    if (device.Start() == 0)
+    {
+        for (unsigned int i = 0; i < Timeout / 10 && (device.WaitingEventsCount() != 0 || !twinReceived); i++)
+        {
+            device.DoWork();
+            ThreadAPI_Sleep(10);
+        }
+    }
+
+    device.Stop();
+
+    return (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv)
+{
+    FakeHub::Config config;
+    int result = 0;
+
+    config.roundTripTime = (argc > 1) ? atoi(argv[1]) : config.roundTripTime;
+    config.bytesPerSecond = (argc > 2) ? strtoul(argv[2], NULL, 10) : config.bytesPerSecond;
+    config.connectTime = (argc > 3) ? atoi(argv[3]) : config.connectTime;
+    config.queuedMessages = 1;
+    config.queuedMethods = 1;
+    FakeHub::Configure(config);
+
+    printf("Round trip %u ms, uplink %lu bytes/s, connect %u ms\n\n", config.roundTripTime, config.bytesPerSecond, config.connectTime);
+    printf("readings  radio on ms  ms/reading  connect ms  payload sent  payload recv  wire sent  wire recv  no burst ms  one at a time ms\n");
+
+    for (size_t i = 0; i < sizeof(BurstSizes) / sizeof(BurstSizes[0]); i++)
+    {
+        IoTHubDevice::BurstReport report;
+        FakeHub::Stats stats;
+        unsigned long unlimited;
+        unsigned long sequential;
+
+        FakeHub::ResetStats();
+        runBurst(BurstSizes[i], report);
+        stats = FakeHub::GetStats();
+        unlimited = runWithoutBurst(BurstSizes[i], 0);
+        sequential = runWithoutBurst(BurstSizes[i], 1);
+
+        if (report.result != 0 || (int)report.eventsSent != BurstSizes[i] || report.methodsAnswered != 1 || report.messagesReceived != 1)
+        {
+            fprintf(stderr, "Burst of %d failed: result %d, %u sent, %u failed, %u methods, %u messages\n",
+                BurstSizes[i], report.result, report.eventsSent, report.eventsFailed, report.methodsAnswered, report.messagesReceived);
+            result = 1;
+        }
+
+        printf("%8d  %11lu  %10.1f  %10lu  %12lu  %12lu  %9lu  %9lu  %11lu  %16lu\n",
+            BurstSizes[i],
+            report.radioOnTime,
+            (double)report.radioOnTime / BurstSizes[i],
+            report.connectTime,
+            report.bytesSent,
+            report.bytesReceived,
+            stats.wireBytesSent,
+            stats.wireBytesReceived,
+            unlimited,
+            sequential);
+    }
+
+    return result;
+}
@@ -0,0 +1,17 @@
+#ifndef _AZUREIOTHUB_H
+#define _AZUREIOTHUB_H
+
+// Host build stand-in for the Arduino AzureIoTHub library header
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "iothub_client_ll.h"
+#include "iothub_message.h"
+#include "azure_c_shared_utility/xlogging.h"
+#include "azure_c_shared_utility/platform.h"
+#include "azure_c_shared_utility/map.h"
+
+#endif // _AZUREIOTHUB_H
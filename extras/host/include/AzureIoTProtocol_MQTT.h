@@ -0,0 +1,8 @@
+#ifndef _AZUREIOTPROTOCOL_MQTT_H
+#define _AZUREIOTPROTOCOL_MQTT_H
+
+// Host build stand-in for the Arduino AzureIoTProtocol_MQTT library header
+
+#include "iothubtransportmqtt.h"
+
+#endif // _AZUREIOTPROTOCOL_MQTT_H
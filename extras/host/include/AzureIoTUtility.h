@@ -0,0 +1,12 @@
+#ifndef _AZUREIOTUTILITY_H
+#define _AZUREIOTUTILITY_H
+
+// Host build stand-in for the Arduino AzureIoTUtility library header
+
+#include "azure_c_shared_utility/agenttime.h"
+#include "azure_c_shared_utility/platform.h"
+#include "azure_c_shared_utility/threadapi.h"
+#include "azure_c_shared_utility/tickcounter.h"
+#include "azure_c_shared_utility/xlogging.h"
+
+#endif // _AZUREIOTUTILITY_H
@@ -0,0 +1,99 @@
+// Expires the SAS token of a connected device on FakeHub and checks the wrapper's handling of the renewal:
+// the reconnect happens at once rather than after the retry delay, the application's retry policy is back
+// in place once the device has authenticated again, and the policy is never changed from inside the SDK.
+//
+//   make build/renewal_check && ./build/renewal_check
+
+#include <chrono>
+#include <cstdio>
+
+#include "FakeHub.h"
+#include "IoTHubDevice.h"
+#include "azure_c_shared_utility/threadapi.h"
+
+static const char *ConnectionString = "HostName=fake.azure-devices.net;DeviceId=renewal;SharedAccessKey=ZmFrZQ==";
+static const unsigned int Timeout = 30000;
+static const IOTHUB_CLIENT_RETRY_POLICY RetryPolicy = IOTHUB_CLIENT_RETRY_LINEAR_BACKOFF;
+static const size_t RetryTimeout = 600;
+
+static void connectionStatusCallback(IoTHubDevice &iotHubDevice, IOTHUB_CLIENT_CONNECTION_STATUS result, IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason, void *userContext)
+{
+    *(bool *)userContext = (result == IOTHUB_CLIENT_CONNECTION_AUTHENTICATED);
+}
+
+// Returns the ms taken to reach the wanted state, or Timeout if it was not reached
+static unsigned int waitFor(IoTHubDevice &device, const bool &authenticated, bool wanted)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    unsigned int elapsed = 0;
+
+    while (authenticated != wanted && elapsed < Timeout)
+    {
+        device.DoWork();
+        ThreadAPI_Sleep(10);
+        elapsed = (unsigned int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    return elapsed;
+}
+
+int main(int argc, char **argv)
+{
+    FakeHub::Config config;
+    IoTHubDevice device(ConnectionString);
+    IOTHUB_CLIENT_RETRY_POLICY retryPolicy;
+    size_t retryTimeout;
+    bool authenticated = false;
+    unsigned int reconnectTime;
+    int result = 0;
+
+    config.connectTime = 200;
+    config.roundTripTime = 50;
+    config.retryDelay = 5000;
+    FakeHub::Configure(config);
+
+    device.SetConnectionStatusCallback(connectionStatusCallback, &authenticated);
+
+    if (device.Start() != 0)
+    {
+        fprintf(stderr, "Failed to start\n");
+        return 1;
+    }
+
+    IoTHubClient_LL_SetRetryPolicy(device.GetHandle(), RetryPolicy, RetryTimeout);
+
+    if (waitFor(device, authenticated, true) >= Timeout)
+    {
+        fprintf(stderr, "Failed to connect\n");
+        return 1;
+    }
+
+    FakeHub::ResetStats();
+    FakeHub::ExpireSasTokens();
+    waitFor(device, authenticated, false);
+    reconnectTime = waitFor(device, authenticated, true);
+
+    // One more so that anything the wrapper defers to DoWork has been done
+    device.DoWork();
+    IoTHubClient_LL_GetRetryPolicy(device.GetHandle(), &retryPolicy, &retryTimeout);
+
+    printf("reconnect ms                %u (retry delay %u)\n", reconnectTime, config.retryDelay);
+    printf("renewals                    %lu\n", device.GetSasTokenRenewalCount());
+    printf("retry policy after          %d/%u (set %d/%u)\n", (int)retryPolicy, (unsigned int)retryTimeout, (int)RetryPolicy, (unsigned int)RetryTimeout);
+    printf("policy changes in DoWork    %lu\n", FakeHub::GetStats().retryPolicyChangesInDoWork);
+
+    if (reconnectTime >= config.retryDelay || device.GetSasTokenRenewalCount() != 1 ||
+        retryPolicy != RetryPolicy || retryTimeout != RetryTimeout || FakeHub::GetStats().retryPolicyChangesInDoWork != 0)
+    {
+        printf("FAILED\n");
+        result = 1;
+    }
+    else
+    {
+        printf("ok\n");
+    }
+
+    device.Stop();
+
+    return result;
+}
@@ -0,0 +1,70 @@
+// Times start up against a real hub, from Start to the first confirmed message, and prints one JSON
+// startup profile per run:
+//
+//   ./build/startup_bench "<connection string>" [runs]
+//
+// The connection string may instead be given in IOTHUB_DEVICE_CONNECTION_STRING.
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "IoTHubDevice.h"
+#include "azure_c_shared_utility/threadapi.h"
+
+static const int TimeoutSeconds = 60;
+
+static void eventConfirmationCallback(IoTHubDevice &iotHubDevice, IoTHubDevice::ConfirmationResult result, void *userContext)
+{
+    if (result != IoTHubDevice::ConfirmationOk)
+    {
+        fprintf(stderr, "Message failed with %d\n", (int)result);
+    }
+
+    *(bool *)userContext = true;
+}
+
+int main(int argc, char **argv)
+{
+    const char *connectionString = (argc > 1) ? argv[1] : getenv("IOTHUB_DEVICE_CONNECTION_STRING");
+    int runs = (argc > 2) ? atoi(argv[2]) : 1;
+    int result = 0;
+
+    if (connectionString == NULL)
+    {
+        fprintf(stderr, "Usage: %s <connection string> [runs]\n", argv[0]);
+        result = 1;
+    }
+
+    for (int run = 0; run < runs && result == 0; run++)
+    {
+        IoTHubDevice device(connectionString);
+        bool confirmed = false;
+        char profile[1024];
+
+        if (device.Start() != 0)
+        {
+            fprintf(stderr, "Start failed\n");
+            result = 1;
+        }
+        else
+        {
+            // Queued until the client is authenticated
+            device.SendEventAsync("{\"startupBench\":1}", eventConfirmationCallback, &confirmed);
+
+            for (int i = 0; i < TimeoutSeconds * 100 && !(confirmed && device.GetStartupProfile().phases[IoTHubDevice::FirstTwin].complete); i++)
+            {
+                device.DoWork();
+                ThreadAPI_Sleep(10);
+            }
+
+            if (device.FormatStartupProfile(profile, sizeof(profile)) > 0)
+            {
+                printf("%s\n", profile);
+            }
+        }
+
+        device.Stop();
+    }
+
+    return result;
+}
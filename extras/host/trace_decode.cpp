@@ -0,0 +1,152 @@
+// Decodes the text written by TraceBuffer::Dump or TraceBuffer::Format. The input may be a serial log
+// containing one or more dumps or the response to the trace device method:
+//
+//   ./build/trace_decode serial.log
+//   az iot hub invoke-device-method ... --method-name trace | ./build/trace_decode
+
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+#include "TraceFormat.h"
+
+static int hexValue(char c)
+{
+    return isdigit((unsigned char)c) ? c - '0' : tolower((unsigned char)c) - 'a' + 10;
+}
+
+static uint32_t readWord(const std::string &hex, size_t offset)
+{
+    uint32_t result = 0;
+
+    for (int i = 0; i < 4; i++)
+    {
+        result |= (uint32_t)(hexValue(hex[offset + i * 2]) * 16 + hexValue(hex[offset + i * 2 + 1])) << (i * 8);
+    }
+
+    return result;
+}
+
+static void printRecord(const TraceFormat::Record &record, uint32_t previousTimestamp)
+{
+    const char *name = TraceFormat::GetEventName(record.event);
+
+    printf("%10u %10u %+8d  ", record.sequence, record.timestamp, (int)(record.timestamp - previousTimestamp));
+
+    if (name != NULL)
+    {
+        printf("%-22s", name);
+    }
+    else if (record.event >= TraceFormat::User)
+    {
+        printf("User+%-17u", record.event - TraceFormat::User);
+    }
+    else
+    {
+        printf("%-22u", record.event);
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        const char *argumentName = TraceFormat::GetArgumentName(record.event, i);
+
+        if (argumentName != NULL)
+        {
+            printf(" %s=%d", argumentName, record.args[i]);
+        }
+        else if (name == NULL)
+        {
+            printf(" %d", record.args[i]);
+        }
+    }
+
+    printf("\n");
+}
+
+// Decodes one dump starting just after the header, returning the offset where it ended
+static size_t decodeDump(const std::string &input, size_t offset)
+{
+    std::string hex;
+    uint32_t previousTimestamp = 0;
+    size_t records = 0;
+
+    // Whitespace separates records in serial dumps, anything else ends the dump
+    while (offset < input.size() && (isxdigit((unsigned char)input[offset]) || isspace((unsigned char)input[offset])))
+    {
+        if (isxdigit((unsigned char)input[offset]))
+        {
+            hex += input[offset];
+        }
+
+        offset++;
+    }
+
+    printf("  sequence  timestamp    delta  event\n");
+
+    for (size_t i = 0; i + TraceFormat::RecordTextLength <= hex.size(); i += TraceFormat::RecordTextLength, records++)
+    {
+        TraceFormat::Record record;
+
+        record.sequence = readWord(hex, i);
+        record.timestamp = readWord(hex, i + 8);
+        record.event = readWord(hex, i + 16);
+
+        for (int j = 0; j < 3; j++)
+        {
+            record.args[j] = (int32_t)readWord(hex, i + 24 + j * 8);
+        }
+
+        printRecord(record, (records == 0) ? record.timestamp : previousTimestamp);
+        previousTimestamp = record.timestamp;
+    }
+
+    if (hex.size() % TraceFormat::RecordTextLength != 0)
+    {
+        fprintf(stderr, "Ignoring %d trailing hex digits\n", (int)(hex.size() % TraceFormat::RecordTextLength));
+    }
+
+    printf("%d records\n\n", (int)records);
+
+    return offset;
+}
+
+int main(int argc, char **argv)
+{
+    std::string input;
+    size_t offset = 0;
+    int dumps = 0;
+
+    if (argc > 1)
+    {
+        std::ifstream file(argv[1]);
+
+        if (!file)
+        {
+            fprintf(stderr, "Unable to open %s\n", argv[1]);
+            return 1;
+        }
+
+        input.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    else
+    {
+        input.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+    }
+
+    while ((offset = input.find(TraceFormat::GetHeader(), offset)) != std::string::npos)
+    {
+        offset = decodeDump(input, offset + strlen(TraceFormat::GetHeader()));
+        dumps++;
+    }
+
+    if (dumps == 0)
+    {
+        fprintf(stderr, "No trace found\n");
+    }
+
+    return (dumps == 0) ? 1 : 0;
+}
@@ -0,0 +1,188 @@
+#ifndef _FIXEDCONTAINERS_H
+#define _FIXEDCONTAINERS_H
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+// Fixed capacity containers used by the static configuration (see IoTHubConfig.h). None of them allocate
+// from the heap or throw - running out of space is reported through the return value instead.
+
+// Pool of objects of type T constructed in place. Create returns NULL when all slots are in use.
+template <typename T, size_t Capacity>
+class FixedPool
+{
+private:
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type _storage[Capacity];
+    bool _inUse[Capacity];
+    size_t _count;
+    size_t _peak;
+
+    FixedPool(const FixedPool &other);
+    FixedPool &operator=(const FixedPool &other);
+
+public:
+    FixedPool() : _count(0), _peak(0)
+    {
+        memset(_inUse, 0, sizeof(_inUse));
+    }
+
+    template <typename... Args>
+    T *Create(Args... args)
+    {
+        T *result = NULL;
+
+        for (size_t i = 0; i < Capacity && result == NULL; i++)
+        {
+            if (!_inUse[i])
+            {
+                _inUse[i] = true;
+                result = new (&_storage[i]) T(args...);
+
+                if (++_count > _peak)
+                    _peak = _count;
+            }
+        }
+
+        return result;
+    }
+
+    void Destroy(T *item)
+    {
+        if (item != NULL)
+        {
+            size_t index = reinterpret_cast<typename std::aligned_storage<sizeof(T), alignof(T)>::type *>(item) - _storage;
+
+            item->~T();
+            _inUse[index] = false;
+            _count--;
+        }
+    }
+
+    size_t Count() const { return _count; }
+    size_t Peak() const { return _peak; }
+    size_t MaxCount() const { return Capacity; }
+};
+
+// Subset of std::vector over a fixed array. T must be default constructible.
+template <typename T, size_t Capacity>
+class FixedVector
+{
+private:
+    T _items[Capacity];
+    size_t _size;
+
+public:
+    FixedVector() : _size(0) {}
+
+    void push_back(const T &item)
+    {
+        if (_size < Capacity)
+            _items[_size++] = item;
+    }
+
+    void clear() { _size = 0; }
+    size_t size() const { return _size; }
+    size_t max_size() const { return Capacity; }
+    bool empty() const { return _size == 0; }
+    T &back() { return _items[_size - 1]; }
+    T &operator[](size_t index) { return _items[index]; }
+    const T &operator[](size_t index) const { return _items[index]; }
+};
+
+// Null terminated string of at most Capacity - 1 characters. Longer values are truncated.
+template <size_t Capacity>
+class FixedString
+{
+private:
+    char _value[Capacity];
+
+public:
+    FixedString() { _value[0] = '\0'; }
+    FixedString(const char *value) { *this = value; }
+
+    FixedString &operator=(const char *value)
+    {
+        strncpy(_value, value, Capacity - 1);
+        _value[Capacity - 1] = '\0';
+
+        return *this;
+    }
+
+    bool operator==(const char *other) const { return strcmp(_value, other) == 0; }
+    const char *c_str() const { return _value; }
+    static bool Fits(const char *value) { return strlen(value) < Capacity; }
+};
+
+// Map keyed on strings of at most KeyCapacity - 1 characters. V must be default constructible.
+template <typename V, size_t Capacity, size_t KeyCapacity>
+class FixedStringMap
+{
+private:
+    struct Entry
+    {
+        FixedString<KeyCapacity> key;
+        V value;
+        bool inUse;
+        Entry() : inUse(false) {}
+    };
+
+    Entry _entries[Capacity];
+
+public:
+    V *Find(const char *key)
+    {
+        V *result = NULL;
+
+        for (size_t i = 0; i < Capacity && result == NULL; i++)
+        {
+            if (_entries[i].inUse && _entries[i].key == key)
+                result = &_entries[i].value;
+        }
+
+        return result;
+    }
+
+    // Adds or replaces the value for key. Returns NULL if the map is full or the key is too long.
+    V *Insert(const char *key, const V &value)
+    {
+        V *result = Find(key);
+
+        if (result == NULL && FixedString<KeyCapacity>::Fits(key))
+        {
+            for (size_t i = 0; i < Capacity && result == NULL; i++)
+            {
+                if (!_entries[i].inUse)
+                {
+                    _entries[i].inUse = true;
+                    _entries[i].key = key;
+                    result = &_entries[i].value;
+                }
+            }
+        }
+
+        if (result != NULL)
+            *result = value;
+
+        return result;
+    }
+
+    bool Erase(const char *key)
+    {
+        bool result = false;
+
+        for (size_t i = 0; i < Capacity && !result; i++)
+        {
+            if (_entries[i].inUse && _entries[i].key == key)
+            {
+                _entries[i].inUse = false;
+                result = true;
+            }
+        }
+
+        return result;
+    }
+};
+
+#endif // _FIXEDCONTAINERS_H
@@ -0,0 +1,183 @@
+#ifndef _IOTHUBAWAITABLE_H
+#define _IOTHUBAWAITABLE_H
+
+// C++20 coroutine interface for IoTHubDevice, intended for gateway builds with a C++20 compiler. It is
+// compiled out on toolchains without <coroutine>.
+//
+// The awaitables live in the awaiting coroutine's frame and are passed to the SDK as the callback user
+// context, so an await does not allocate. The confirmation only records the result; the coroutine is
+// resumed by IoTHubDevice::DoWork (or Stop) once the SDK call that confirmed it has returned, so a coroutine
+// never runs inside the SDK or inside another coroutine's co_await. The usual DoWork loop drives them:
+//
+// IoTHubTask SendReadings(IoTHubDevice &device)
+// {
+//     for (int i = 0; i < 10; i++)
+//     {
+//         IoTHubDevice::ConfirmationResult result = co_await AwaitSendEvent(device, "{ \"reading\": 1 }");
+//         ...
+//     }
+// }
+//
+// Any number of tasks may be started and will have messages in flight at the same time.
+
+#if defined(__has_include) && __cplusplus >= 202002L
+#if __has_include(<coroutine>)
+#define IOTHUB_HAS_COROUTINES
+#endif
+#endif
+
+#ifdef IOTHUB_HAS_COROUTINES
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+#include "IoTHubDevice.h"
+
+// Coroutine return type. The coroutine starts running immediately and its frame is kept until the task is
+// destroyed so Done can be polled from the DoWork loop. A task must not be destroyed while it is still
+// waiting on the hub.
+class IoTHubTask
+{
+public:
+    struct promise_type
+    {
+        IoTHubTask get_return_object() { return IoTHubTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+private:
+    std::coroutine_handle<promise_type> _handle;
+
+    explicit IoTHubTask(std::coroutine_handle<promise_type> handle) : _handle(handle) {}
+
+public:
+    IoTHubTask(IoTHubTask &&other) noexcept : _handle(std::exchange(other._handle, nullptr)) {}
+    IoTHubTask(const IoTHubTask &other) = delete;
+    IoTHubTask &operator=(const IoTHubTask &other) = delete;
+
+    ~IoTHubTask()
+    {
+        if (_handle)
+            _handle.destroy();
+    }
+
+    bool Done() const { return !_handle || _handle.done(); }
+};
+
+// Result of co_await is the ConfirmationResult passed to EventConfirmationCallback, or
+// IoTHubDevice::ConfirmationError if the message could not be queued.
+class SendEventAwaitable
+{
+private:
+    IoTHubDevice &_iotHubDevice;
+    const IoTHubMessage *_message;
+    const char *_string;
+    unsigned int _timeToLive;
+    IoTHubDevice::ConfirmationResult _result;
+    IoTHubDevice::DeferredCall _resume;
+
+    static void Confirmation(IoTHubDevice &iotHubDevice, IoTHubDevice::ConfirmationResult result, void *userContext)
+    {
+        SendEventAwaitable *that = (SendEventAwaitable *)userContext;
+
+        that->_result = result;
+        iotHubDevice.Defer(&that->_resume);
+    }
+
+    static void Resume(void *userContext)
+    {
+        std::coroutine_handle<>::from_address(userContext).resume();
+    }
+
+public:
+    SendEventAwaitable(IoTHubDevice &iotHubDevice, const IoTHubMessage *message, const char *string, unsigned int timeToLive) :
+        _iotHubDevice(iotHubDevice), _message(message), _string(string), _timeToLive(timeToLive), _result(IoTHubDevice::ConfirmationError), _resume()
+    {
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> continuation)
+    {
+        IOTHUB_CLIENT_RESULT sendResult;
+
+        _resume.function = Resume;
+        _resume.userContext = continuation.address();
+
+        if (_message != NULL)
+            sendResult = _iotHubDevice.SendEventAsync(_message, Confirmation, this, _timeToLive);
+        else
+            sendResult = _iotHubDevice.SendEventAsync(_string, Confirmation, this, _timeToLive);
+
+        // Carry straight on if the message never made it into the queue
+        return sendResult == IOTHUB_CLIENT_OK;
+    }
+
+    IoTHubDevice::ConfirmationResult await_resume() const noexcept { return _result; }
+};
+
+// Result of co_await is the status code passed to ReportedStateCallback, or -1 if the update could not be queued
+// or was still outstanding when the device was stopped.
+class ReportedStateAwaitable
+{
+private:
+    IoTHubDevice &_iotHubDevice;
+    const char *_reportedState;
+    int _statusCode;
+    IoTHubDevice::DeferredCall _resume;
+
+    static void Confirmation(IoTHubDevice &iotHubDevice, int statusCode, void *userContext)
+    {
+        ReportedStateAwaitable *that = (ReportedStateAwaitable *)userContext;
+
+        that->_statusCode = statusCode;
+        iotHubDevice.Defer(&that->_resume);
+    }
+
+    static void Resume(void *userContext)
+    {
+        std::coroutine_handle<>::from_address(userContext).resume();
+    }
+
+public:
+    ReportedStateAwaitable(IoTHubDevice &iotHubDevice, const char *reportedState) :
+        _iotHubDevice(iotHubDevice), _reportedState(reportedState), _statusCode(-1), _resume()
+    {
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> continuation)
+    {
+        _resume.function = Resume;
+        _resume.userContext = continuation.address();
+
+        return _iotHubDevice.SendReportedState(_reportedState, Confirmation, this) == IOTHUB_CLIENT_OK;
+    }
+
+    int await_resume() const noexcept { return _statusCode; }
+};
+
+// The message is copied when the await starts so it need only live until then
+inline SendEventAwaitable AwaitSendEvent(IoTHubDevice &iotHubDevice, const IoTHubMessage *message, unsigned int timeToLive = 0)
+{
+    return SendEventAwaitable(iotHubDevice, message, NULL, timeToLive);
+}
+
+inline SendEventAwaitable AwaitSendEvent(IoTHubDevice &iotHubDevice, const char *message, unsigned int timeToLive = 0)
+{
+    return SendEventAwaitable(iotHubDevice, NULL, message, timeToLive);
+}
+
+inline ReportedStateAwaitable AwaitReportedState(IoTHubDevice &iotHubDevice, const char *reportedState)
+{
+    return ReportedStateAwaitable(iotHubDevice, reportedState);
+}
+
+#endif // IOTHUB_HAS_COROUTINES
+
+#endif // _IOTHUBAWAITABLE_H
@@ -0,0 +1,158 @@
+#ifndef _IOTHUBCONFIG_H
+#define _IOTHUBCONFIG_H
+
+#include <cstddef>
+
+#include "azure_c_shared_utility/xlogging.h"
+
+// Build configuration for the wrapper.
+//
+// By default the wrapper uses the heap and std::map/std::string and throws std::runtime_error when an
+// object cannot be constructed. Defining IOTHUB_STATIC_CONFIG (normally together with -fno-exceptions)
+// builds it without exceptions and without any heap allocation of its own. All containers are then
+// fixed size with the limits below, which can be overridden from the compiler command line. In this
+// configuration constructors that fail leave the object invalid (see IoTHubMessage::IsValid) and
+// everything else reports errors through its return value. There is one set of limits per build, shared
+// by every object in it.
+//
+// Note that the Azure IoT SDK itself continues to use the heap in either configuration.
+
+#ifndef IOTHUB_MAX_DEVICE_METHODS
+#define IOTHUB_MAX_DEVICE_METHODS 8         // Device methods registered with SetDeviceMethodCallback
+#endif
+
+#ifndef IOTHUB_MAX_EVENTS
+#define IOTHUB_MAX_EVENTS 16                // Messages pending or in flight with SendEventAsync
+#endif
+
+#ifndef IOTHUB_MAX_REPORTED_STATES
+#define IOTHUB_MAX_REPORTED_STATES 4        // Reported state updates in flight with SendReportedState
+#endif
+
+#ifndef IOTHUB_MAX_PROPERTIES
+#define IOTHUB_MAX_PROPERTIES 8             // Signals per TelemetryAggregator, each becomes a record property
+#endif
+
+#ifndef IOTHUB_MAX_PANES
+#define IOTHUB_MAX_PANES 8                  // Hops per TelemetryAggregator sliding window, 16 without IOTHUB_STATIC_CONFIG
+#endif
+
+#ifndef IOTHUB_MAX_RECORD_SIZE
+#define IOTHUB_MAX_RECORD_SIZE 512          // Largest TelemetryAggregator record, unlimited without IOTHUB_STATIC_CONFIG
+#endif
+
+#ifndef IOTHUB_MAX_NAME_LENGTH
+#define IOTHUB_MAX_NAME_LENGTH 32           // Method and signal names including the terminator
+#endif
+
+#ifndef IOTHUB_MAX_TWIN_SIZE
+#define IOTHUB_MAX_TWIN_SIZE 1024           // Largest device twin payload passed to DeviceTwinCallback
+#endif
+
+#ifndef IOTHUB_MAX_ROUTES
+#define IOTHUB_MAX_ROUTES 16                // Routes per MessageRouter
+#endif
+
+#ifndef IOTHUB_TRACE_RECORDS
+#define IOTHUB_TRACE_RECORDS 128            // Records kept by a TraceBuffer, 24 bytes each, a power of two
+#endif
+
+#ifdef IOTHUB_STATIC_CONFIG
+
+#include "FixedContainers.h"
+
+template <typename T, size_t Capacity> using IoTHubPool = FixedPool<T, Capacity>;
+template <typename T, size_t Capacity> using IoTHubVector = FixedVector<T, Capacity>;
+template <typename V, size_t Capacity> using IoTHubStringMap = FixedStringMap<V, Capacity, IOTHUB_MAX_NAME_LENGTH>;
+typedef FixedString<IOTHUB_MAX_NAME_LENGTH> IoTHubString;
+
+#define IOTHUB_THROW(message) LogError("%s", message)
+#define IOTHUB_NAME_FITS(name) (strlen(name) < IOTHUB_MAX_NAME_LENGTH)
+
+#else
+
+#include <map>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+// Heap backed equivalent of FixedPool. Capacity is ignored.
+template <typename T, size_t Capacity>
+class HeapPool
+{
+private:
+    size_t _count;
+    size_t _peak;
+
+    HeapPool(const HeapPool &other);
+    HeapPool &operator=(const HeapPool &other);
+
+public:
+    HeapPool() : _count(0), _peak(0) {}
+
+    template <typename... Args>
+    T *Create(Args... args)
+    {
+        T *result = new T(args...);
+
+        if (++_count > _peak)
+            _peak = _count;
+
+        return result;
+    }
+
+    void Destroy(T *item)
+    {
+        if (item != NULL)
+        {
+            delete item;
+            _count--;
+        }
+    }
+
+    size_t Count() const { return _count; }
+    size_t Peak() const { return _peak; }
+    size_t MaxCount() const { return (size_t)-1; }
+};
+
+// Heap backed equivalent of FixedStringMap. Capacity is ignored.
+template <typename V, size_t Capacity>
+class HeapStringMap
+{
+private:
+    std::map<std::string, V> _entries;
+
+public:
+    V *Find(const char *key)
+    {
+        typename std::map<std::string, V>::iterator it = _entries.find(key);
+
+        return (it == _entries.end()) ? NULL : &(it->second);
+    }
+
+    V *Insert(const char *key, const V &value)
+    {
+        V *result = &_entries[key];
+
+        *result = value;
+
+        return result;
+    }
+
+    bool Erase(const char *key)
+    {
+        return _entries.erase(key) != 0;
+    }
+};
+
+template <typename T, size_t Capacity> using IoTHubPool = HeapPool<T, Capacity>;
+template <typename T, size_t Capacity> using IoTHubVector = std::vector<T>;
+template <typename V, size_t Capacity> using IoTHubStringMap = HeapStringMap<V, Capacity>;
+typedef std::string IoTHubString;
+
+#define IOTHUB_THROW(message) throw std::runtime_error(message)
+#define IOTHUB_NAME_FITS(name) (true)
+
+#endif // IOTHUB_STATIC_CONFIG
+
+#endif // _IOTHUBCONFIG_H
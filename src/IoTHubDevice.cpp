@@ -1,10 +1,15 @@
 #include "IoTHubDevice.h"
+#include "TraceBuffer.h"
+
+#include <cstdio>
 
 #include <AzureIoTProtocol_MQTT.h>
 #include <AzureIoTUtility.h>
 #include <azure_c_shared_utility/connection_string_parser.h>
 #include <azure_c_shared_utility/shared_util_options.h>
+#include <azure_c_shared_utility/threadapi.h>
 #include "iothub_client_version.h"
+#include "iothub_client_options.h"
 
 using namespace std;
 
@@ -21,10 +26,55 @@ IoTHubDevice::IoTHubDevice(const char *connectionString, Protocol protocol) :
     _x509Certificate(NULL),
     _x509PrivateKey(NULL),
     _deviceHandle(NULL),
-    _startResult(-1)
+    _startResult(-1),
+    _parsedCS(NULL),
+    _tickCounter(tickcounter_create()),
+    _messageTimeToLive(0),
+    _maxPendingEvents(0),
+    _maxInFlightEvents(0),
+    _overflowPolicy(DropOldest),
+    _blockTimeout(DefaultBlockTimeout),
+    _inCallback(false),
+    _authenticated(false),
+    _pendingEventCount(0),
+    _inFlightEventCount(0),
+    _usesSasKey(false),
+    _sasTokenLifetime(0),
+    _sasTokenRenewalMargin(0),
+    _authenticatedAt(0),
+    _renewingSasToken(false),
+    _sasTokenRenewalStartedAt(0),
+    _retryPolicy(IOTHUB_CLIENT_RETRY_EXPONENTIAL_BACKOFF_WITH_JITTER),
+    _retryTimeout(0),
+    _immediateRetry(false),
+    _sasTokenRenewalCount(0),
+    _lastSasTokenRenewalDuration(0),
+    _twinCacheApplied(false),
+    _twinReceived(false),
+    _startedAt(0),
+    _traceBuffer(NULL),
+    _nextMessageId(0),
+    _eventsConfirmed(0),
+    _eventsFailed(0),
+    _messagesReceived(0),
+    _methodsAnswered(0),
+    _bytesSent(0),
+    _bytesReceived(0)
 {
     _connectionString = connectionString;
     _protocol = protocol;
+    memset(&_startupProfile, 0, sizeof(_startupProfile));
+
+    // Messages may be queued before Start
+    DList_InitializeListHead(&_outstandingEventList);
+    DList_InitializeListHead(&_outstandingReportedStateEventList);
+    DList_InitializeListHead(&_pendingEventList);
+    DList_InitializeListHead(&_deferredCallList);
+
+    if (_tickCounter == NULL)
+    {
+        LogError("Failed to create tick counter");
+    }
 }
 
 IoTHubDevice::IoTHubDevice(const char *connectionString, const char *x509Certificate, const char *x509PrivateKey, Protocol protocol) :
@@ -40,10 +90,55 @@ IoTHubDevice::IoTHubDevice(const char *connectionString, const char *x509Certifi
     _x509Certificate(x509Certificate),
     _x509PrivateKey(x509PrivateKey),
     _deviceHandle(NULL),
-    _startResult(-1)
+    _startResult(-1),
+    _parsedCS(NULL),
+    _tickCounter(tickcounter_create()),
+    _messageTimeToLive(0),
+    _maxPendingEvents(0),
+    _maxInFlightEvents(0),
+    _overflowPolicy(DropOldest),
+    _blockTimeout(DefaultBlockTimeout),
+    _inCallback(false),
+    _authenticated(false),
+    _pendingEventCount(0),
+    _inFlightEventCount(0),
+    _usesSasKey(false),
+    _sasTokenLifetime(0),
+    _sasTokenRenewalMargin(0),
+    _authenticatedAt(0),
+    _renewingSasToken(false),
+    _sasTokenRenewalStartedAt(0),
+    _retryPolicy(IOTHUB_CLIENT_RETRY_EXPONENTIAL_BACKOFF_WITH_JITTER),
+    _retryTimeout(0),
+    _immediateRetry(false),
+    _sasTokenRenewalCount(0),
+    _lastSasTokenRenewalDuration(0),
+    _twinCacheApplied(false),
+    _twinReceived(false),
+    _startedAt(0),
+    _traceBuffer(NULL),
+    _nextMessageId(0),
+    _eventsConfirmed(0),
+    _eventsFailed(0),
+    _messagesReceived(0),
+    _methodsAnswered(0),
+    _bytesSent(0),
+    _bytesReceived(0)
 {
     _connectionString = connectionString;
     _protocol = protocol;
+    memset(&_startupProfile, 0, sizeof(_startupProfile));
+
+    // Messages may be queued before Start
+    DList_InitializeListHead(&_outstandingEventList);
+    DList_InitializeListHead(&_outstandingReportedStateEventList);
+    DList_InitializeListHead(&_pendingEventList);
+    DList_InitializeListHead(&_deferredCallList);
+
+    if (_tickCounter == NULL)
+    {
+        LogError("Failed to create tick counter");
+    }
 }
 
 IoTHubDevice::~IoTHubDevice()
@@ -52,28 +147,53 @@ IoTHubDevice::~IoTHubDevice()
     {
         Stop();
     }
+
+    // Queued but Start was never called
+    while (!DList_IsListEmpty(&_pendingEventList))
+    {
+        DiscardPendingEvent(containingRecord(_pendingEventList.Flink, MessageUserContext, dlistEntry), ConfirmationBecauseDestroy);
+    }
+
+    if (_tickCounter != NULL)
+    {
+        tickcounter_destroy(_tickCounter);
+    }
 }
 
 int IoTHubDevice::Start()
 {
     int result = _startResult = 0;
-    DList_InitializeListHead(&_outstandingEventList);
-    DList_InitializeListHead(&_outstandingReportedStateEventList);
+    _twinCacheApplied = false;
+    _twinReceived = false;
 
-    _parsedCS = new MapUtil(connectionstringparser_parse_from_char(_connectionString), true);
+    // Needed before anything else so the whole of start up can be timed
+    if (_tickCounter == NULL)
+    {
+        _tickCounter = tickcounter_create();
+    }
+
+    memset(&_startupProfile, 0, sizeof(_startupProfile));
+    _startedAt = GetTickCount();
+
+    BeginStartupPhase(ParseConnectionString);
+    _parsedCS.Reset(connectionstringparser_parse_from_char(_connectionString), true);
+    EndStartupPhase(ParseConnectionString);
 
-    if (_parsedCS == NULL)
+    if (_parsedCS.GetHandle() == NULL)
     {
         LogError("Failed to parse connection string");
         result = __FAILURE__;
     }
-    else if (_parsedCS->ContainsKey("X509") && (_x509Certificate == NULL || _x509PrivateKey == NULL))
+    else if (_parsedCS.ContainsKey("X509") && (_x509Certificate == NULL || _x509PrivateKey == NULL))
     {
         LogError("X509 requires certificate and private key");
         result = __FAILURE__;
     }
     else
     {
+        // Only tokens generated from a device key are renewed by the SDK
+        _usesSasKey = _x509Certificate == NULL && _parsedCS.ContainsKey("SharedAccessKey");
+
         if ((_x509Certificate == NULL && _x509PrivateKey != NULL) ||
             (_x509Certificate != NULL && _x509PrivateKey == NULL))
         {
@@ -82,17 +202,28 @@ int IoTHubDevice::Start()
         }
         else
         {
+            BeginStartupPhase(PlatformInit);
             platform_init();
+            EndStartupPhase(PlatformInit);
 
+            BeginStartupPhase(CreateClient);
             _deviceHandle = IoTHubClient_LL_CreateFromConnectionString(_connectionString, GetProtocol(_protocol));
+            EndStartupPhase(CreateClient);
 
             if (_deviceHandle == NULL)
             {
                 LogError("Failed to create IoT hub handle");
                 result = __FAILURE__;
             }
+            else if (_tickCounter == NULL)
+            {
+                LogError("Failed to create tick counter");
+                result = __FAILURE__;
+            }
             else
             {
+                BeginStartupPhase(SetOptions);
+
                 if (_x509Certificate != NULL)
                 {
                     if (
@@ -118,17 +249,60 @@ int IoTHubDevice::Start()
                         result = __FAILURE__;
                     }
                 }
+
+                if (result == 0 && _sasTokenLifetime != 0)
+                {
+                    if (IoTHubClient_LL_SetOption(GetHandle(), OPTION_SAS_TOKEN_LIFETIME, &_sasTokenLifetime) != IOTHUB_CLIENT_OK)
+                    {
+                        LogError("Failed to set SAS token lifetime");
+                        result = __FAILURE__;
+                    }
+                }
+
+                if (result == 0 && _messageTimeToLive != 0)
+                {
+                    tickcounter_ms_t messageTimeout = _messageTimeToLive;
+
+                    if (IoTHubClient_LL_SetOption(GetHandle(), OPTION_MESSAGE_TIMEOUT, &messageTimeout) != IOTHUB_CLIENT_OK)
+                    {
+                        LogError("Failed to set message timeout");
+                        result = __FAILURE__;
+                    }
+                }
+
+                EndStartupPhase(SetOptions);
             }
         }
     }
 
     _startResult = result;
 
+    // Run from the last known configuration until the hub sends the current one. It is passed to the
+    // DeviceTwinCallback from the first DoWork so that the application can finish setting up first.
+    if (result == 0)
+    {
+        _twinCache.Load();
+    }
+
+    if (result == 0)
+    {
+        BeginStartupPhase(FirstDoWork);
+    }
+
+    Trace(TraceBuffer::Start, result);
+
     return result;
 }
 
 void IoTHubDevice::Stop()
 {
+    bool inCallback = _inCallback;
+
+    Trace(TraceBuffer::Stop, (int32_t)_pendingEventCount, (int32_t)_inFlightEventCount);
+
+    // The SDK confirms whatever it still holds from inside destroy
+    _inCallback = true;
+
     if (_deviceHandle != NULL)
     {
         IoTHubClient_LL_Destroy(_deviceHandle);
@@ -136,28 +310,44 @@ void IoTHubDevice::Stop()
         _startResult = -1;
     }
 
+    _authenticated = false;
+    _renewingSasToken = false;
+    _immediateRetry = false;
+
+    // Messages that never made it to the SDK are reported the same way the SDK reports its own
+    while (!DList_IsListEmpty(&_pendingEventList))
+    {
+        DiscardPendingEvent(containingRecord(_pendingEventList.Flink, MessageUserContext, dlistEntry), ConfirmationBecauseDestroy);
+    }
+
     platform_deinit();
 
     while (!DList_IsListEmpty(&_outstandingEventList))
     {
         PDLIST_ENTRY work = _outstandingEventList.Flink;
         DList_RemoveEntryList(work);
-        delete work;
+        _messageUserContexts.Destroy(containingRecord(work, MessageUserContext, dlistEntry));
     }
 
+    _inFlightEventCount = 0;
+
+    // The SDK drops reported state updates on destroy without calling back, so fail them here
     while(!DList_IsListEmpty(&_outstandingReportedStateEventList))
     {
-        PDLIST_ENTRY work = _outstandingReportedStateEventList.Flink;
-        DList_RemoveEntryList(work);
-        delete work;
-    }
+        ReportedStateUserContext *reportedStateUC = containingRecord(_outstandingReportedStateEventList.Flink, ReportedStateUserContext, dlistEntry);
+        DList_RemoveEntryList(&(reportedStateUC->dlistEntry));
 
-    for (map<std::string, DeviceMethodUserContext *>::iterator it = _deviceMethods.begin(); it != _deviceMethods.end(); it++)
-    {
-        delete it->second;
+        if (reportedStateUC->reportedStateCallback != NULL)
+        {
+            reportedStateUC->reportedStateCallback(*this, -1, reportedStateUC->userContext);
+        }
+
+        _reportedStateUserContexts.Destroy(reportedStateUC);
     }
 
-    delete _parsedCS;
+    _parsedCS.Reset(NULL);
+    _inCallback = inCallback;
+    RunDeferredCalls();
 }
 
 IoTHubDevice::MessageCallback IoTHubDevice::SetMessageCallback(MessageCallback messageCallback, void *userContext)
@@ -185,12 +375,12 @@ IOTHUB_CLIENT_LL_HANDLE IoTHubDevice::GetHandle() const
 
 const char *IoTHubDevice::GetHostName()
 {
-  return _parsedCS->GetValue("HostName");
+  return _parsedCS.GetValue("HostName");
 }
 
 const char *IoTHubDevice::GetDeviceId()
 {
-  return _parsedCS->GetValue("DeviceId");
+  return _parsedCS.GetValue("DeviceId");
 }
 
 const char *IoTHubDevice::GetVersion()
@@ -212,38 +402,42 @@ IoTHubDevice::ConnectionStatusCallback IoTHubDevice::SetConnectionStatusCallback
     ConnectionStatusCallback temp = _connectionStatusCallback;
     _connectionStatusCallback = connectionStatusCallback;
     _connectionStatusCallbackUC = userContext;
+
+    return temp;
 }
 
 IoTHubDevice::DeviceMethodCallback IoTHubDevice::SetDeviceMethodCallback(const char *methodName, DeviceMethodCallback deviceMethodCallback, void *userContext)
 {
-    DeviceMethodUserContext *deviceMethodUserContext = new DeviceMethodUserContext(deviceMethodCallback, userContext);
-    map<std::string, DeviceMethodUserContext *>::iterator it;
+    DeviceMethodUserContext *deviceMethodUserContext = _deviceMethods.Find(methodName);
     DeviceMethodCallback temp = NULL;
 
-    it = _deviceMethods.find(methodName);
+    if (deviceMethodUserContext != NULL)
+    {
+        temp = deviceMethodUserContext->deviceMethodCallback;
+    }
 
-    if (it == _deviceMethods.end())
+    if (deviceMethodCallback == NULL)
     {
-        _deviceMethods[methodName] = deviceMethodUserContext;
+        _deviceMethods.Erase(methodName);
     }
-    else
+    else if (_deviceMethods.Insert(methodName, DeviceMethodUserContext(deviceMethodCallback, userContext)) == NULL)
     {
-        temp = it->second->deviceMethodCallback;
-        delete it->second;
-
-        if (deviceMethodCallback != NULL)
-        {
-            it->second = deviceMethodUserContext;
-        }
-        else
-        {
-            _deviceMethods.erase(it);
-        }
+        LogError("Unable to register device method %s", methodName);
+        temp = DeviceMethodNotRegistered;
     }
 
     return temp;
 }
 
+// Only ever returned by SetDeviceMethodCallback, never called by the wrapper
+int IoTHubDevice::DeviceMethodNotRegistered(IoTHubDevice &iotHubDevice, const unsigned char *payload, size_t size, unsigned char **response, size_t *resp_size, void *userContext)
+{
+    *response = NULL;
+    *resp_size = 0;
+
+    return 500;
+}
+
 IoTHubDevice::UnknownDeviceMethodCallback IoTHubDevice::SetUnknownDeviceMethodCallback(UnknownDeviceMethodCallback unknownDeviceMethodCallback, void *userContext)
 {
     UnknownDeviceMethodCallback temp = _unknownDeviceMethodCallback;
@@ -262,49 +456,146 @@ IoTHubDevice::DeviceTwinCallback IoTHubDevice::SetDeviceTwinCallback(DeviceTwinC
     return temp;
 }
 
-IOTHUB_CLIENT_RESULT IoTHubDevice::SendEventAsync(const string &message, EventConfirmationCallback eventConfirmationCallback, void *userContext)
+#ifndef IOTHUB_STATIC_CONFIG
+IOTHUB_CLIENT_RESULT IoTHubDevice::SendEventAsync(const string &message, EventConfirmationCallback eventConfirmationCallback, void *userContext, unsigned int timeToLive)
 {
     IOTHUB_CLIENT_RESULT result;
 
-    result = SendEventAsync(message.c_str(), eventConfirmationCallback, userContext);
+    result = SendEventAsync(message.c_str(), eventConfirmationCallback, userContext, timeToLive);
 
     return result;
 }
+#endif
 
-IOTHUB_CLIENT_RESULT IoTHubDevice::SendEventAsync(const char *message, EventConfirmationCallback eventConfirmationCallback, void *userContext)
+IOTHUB_CLIENT_RESULT IoTHubDevice::SendEventAsync(const char *message, EventConfirmationCallback eventConfirmationCallback, void *userContext, unsigned int timeToLive)
 {
-    IoTHubMessage *hubMessage = new IoTHubMessage(message);
+    IoTHubMessage hubMessage(message);
     IOTHUB_CLIENT_RESULT result;
 
-    result =  SendEventAsync(hubMessage, eventConfirmationCallback, userContext);
-
-    delete hubMessage;
+    result =  SendEventAsync(&hubMessage, eventConfirmationCallback, userContext, timeToLive);
 
     return result;
 }
 
-IOTHUB_CLIENT_RESULT IoTHubDevice::SendEventAsync(const uint8_t *message, size_t length, EventConfirmationCallback eventConfirmationCallback, void *userContext)
+IOTHUB_CLIENT_RESULT IoTHubDevice::SendEventAsync(const uint8_t *message, size_t length, EventConfirmationCallback eventConfirmationCallback, void *userContext, unsigned int timeToLive)
 {
-    IoTHubMessage *hubMessage = new IoTHubMessage(message, length);
+    IoTHubMessage hubMessage(message, length);
     IOTHUB_CLIENT_RESULT result;
 
-    result =  SendEventAsync(hubMessage, eventConfirmationCallback, userContext);
-
-    delete hubMessage;
+    result =  SendEventAsync(&hubMessage, eventConfirmationCallback, userContext, timeToLive);
 
     return result;
 }
 
-IOTHUB_CLIENT_RESULT IoTHubDevice::SendEventAsync(const IoTHubMessage *message, EventConfirmationCallback eventConfirmationCallback, void *userContext)
+IOTHUB_CLIENT_RESULT IoTHubDevice::SendEventAsync(const IoTHubMessage *message, EventConfirmationCallback eventConfirmationCallback, void *userContext, unsigned int timeToLive)
 {
-    MessageUserContext *messageUC = new MessageUserContext(this, eventConfirmationCallback, userContext);
+    MessageUserContext *messageUC = _messageUserContexts.Create(this, eventConfirmationCallback, userContext);
     IOTHUB_CLIENT_RESULT result;
+    bool dropped = false;
 
-    result = IoTHubClient_LL_SendEventAsync(GetHandle(), message->GetHandle(), InternalEventConfirmationCallback, messageUC);
+    if (timeToLive == 0)
+    {
+        timeToLive = _messageTimeToLive;
+    }
 
-    if (result == IOTHUB_CLIENT_OK)
+    if (messageUC != NULL)
     {
-        DList_InsertTailList(&_outstandingEventList, &(messageUC->dlistEntry));
+        messageUC->id = ++_nextMessageId;
+
+        if (timeToLive != 0)
+        {
+            messageUC->expiry = GetTickCount() + timeToLive;
+        }
+    }
+
+    if (!message->IsValid())
+    {
+        result = IOTHUB_CLIENT_INVALID_ARG;
+    }
+    else if (messageUC == NULL)
+    {
+        LogError("Too many messages outstanding");
+        result = IOTHUB_CLIENT_ERROR;
+    }
+    else if (DList_IsListEmpty(&_pendingEventList) && CanSubmitEvent())
+    {
+        // Nothing is queued ahead of this message so it can go straight to the SDK
+        result = SubmitEvent(messageUC, message->GetHandle());
+    }
+    else
+    {
+        if (_maxPendingEvents != 0 && _pendingEventCount >= _maxPendingEvents)
+        {
+            switch (_overflowPolicy)
+            {
+            case OverflowPolicy::DropOldest:
+                // More than one if the limit has been lowered since the queue filled
+                while (_pendingEventCount >= _maxPendingEvents)
+                {
+                    DiscardPendingEvent(containingRecord(_pendingEventList.Flink, MessageUserContext, dlistEntry), ConfirmationDropped);
+                }
+                break;
+            case OverflowPolicy::DropNewest:
+                dropped = true;
+                break;
+            case OverflowPolicy::Block:
+                if (_inCallback)
+                {
+                    LogError("Cannot wait for space in the pending event queue from inside a callback");
+                }
+                else
+                {
+                    // Space is only made by the link coming back or by queued messages expiring
+                    tickcounter_ms_t waitUntil = GetTickCount() + ((timeToLive != 0 && timeToLive < _blockTimeout) ? timeToLive : _blockTimeout);
+
+                    while (_deviceHandle != NULL && _pendingEventCount >= _maxPendingEvents && GetTickCount() < waitUntil)
+                    {
+                        DoWork();
+                        ThreadAPI_Sleep(10);
+                    }
+                }
+                break;
+            default:
+                break;
+            }
+        }
+
+        if (dropped)
+        {
+            // Reported the same way as DropOldest so every dropped message reaches its callback
+            Trace(TraceBuffer::Discard, (int32_t)messageUC->id, ConfirmationDropped);
+            _eventsFailed++;
+
+            if (eventConfirmationCallback != NULL)
+            {
+                eventConfirmationCallback(*this, ConfirmationDropped, userContext);
+            }
+
+            result = IOTHUB_CLIENT_OK;
+        }
+        else if (_maxPendingEvents != 0 && _pendingEventCount >= _maxPendingEvents)
+        {
+            LogError("Pending event queue is full");
+            result = IOTHUB_CLIENT_ERROR;
+        }
+        else if ((messageUC->message = IoTHubMessage_Clone(message->GetHandle())) == NULL)
+        {
+            LogError("Failed to copy message for pending event queue");
+            result = IOTHUB_CLIENT_ERROR;
+        }
+        else
+        {
+            DList_InsertTailList(&_pendingEventList, &(messageUC->dlistEntry));
+            _pendingEventCount++;
+            result = IOTHUB_CLIENT_OK;
+        }
+    }
+
+    Trace(TraceBuffer::Send, (messageUC != NULL) ? (int32_t)messageUC->id : 0, result, (int32_t)_pendingEventCount);
+
+    if (result != IOTHUB_CLIENT_OK || dropped)
+    {
+        _messageUserContexts.Destroy(messageUC);
     }
 
     return result;
@@ -312,35 +603,530 @@ IOTHUB_CLIENT_RESULT IoTHubDevice::SendEventAsync(const IoTHubMessage *message,
     
 IOTHUB_CLIENT_RESULT IoTHubDevice::SendReportedState(const char* reportedState, ReportedStateCallback reportedStateCallback, void* userContext)
 {
-    ReportedStateUserContext *reportedStateUC = new ReportedStateUserContext(this, reportedStateCallback, userContext);
+    ReportedStateUserContext *reportedStateUC = _reportedStateUserContexts.Create(this, reportedStateCallback, userContext);
     IOTHUB_CLIENT_RESULT result;
     
-    result = IoTHubClient_LL_SendReportedState(GetHandle(), (const unsigned char *)reportedState, strlen(reportedState), InternalReportedStateCallback, reportedStateUC);
-
-    if (result == IOTHUB_CLIENT_OK)
+    if (reportedStateUC == NULL)
     {
-        DList_InsertTailList(&_outstandingReportedStateEventList, &(reportedStateUC->dlistEntry));
+        LogError("Too many reported state updates outstanding");
+        result = IOTHUB_CLIENT_ERROR;
     }
+    else
+    {
+        result = IoTHubClient_LL_SendReportedState(GetHandle(), (const unsigned char *)reportedState, strlen(reportedState), InternalReportedStateCallback, reportedStateUC);
+
+        if (result == IOTHUB_CLIENT_OK)
+        {
+            DList_InsertTailList(&_outstandingReportedStateEventList, &(reportedStateUC->dlistEntry));
+            _bytesSent += strlen(reportedState);
+        }
+        else
+        {
+            _reportedStateUserContexts.Destroy(reportedStateUC);
+        }
+    }
+
+    return result;
 }
 
 void IoTHubDevice::DoWork()
 {
+    // Until authenticated the SDK may block in here resolving, connecting and handshaking
+    bool connecting = !_startupProfile.phases[Connect].complete;
+    bool timed = connecting || _traceBuffer != NULL;
+    bool inCallback = _inCallback;
+    tickcounter_ms_t doWorkStart = 0;
+
+    _inCallback = true;
+    ApplyCachedTwin();
+    PurgeExpiredEvents();
+    SubmitPendingEvents();
+
+    if (connecting)
+    {
+        EndStartupPhase(FirstDoWork);
+        BeginStartupPhase(Connect);
+    }
+
+    if (timed)
+    {
+        doWorkStart = GetTickCount();
+    }
+
     IoTHubClient_LL_DoWork(GetHandle());
+
+    if (timed)
+    {
+        tickcounter_ms_t duration = GetTickCount() - doWorkStart;
+
+        if (connecting)
+        {
+            _startupProfile.connectDoWorkTime += (unsigned long)duration;
+            _startupProfile.connectDoWorkCalls++;
+        }
+
+        // Calls that returned within the tick are left out so idle polling does not flush the trace
+        if (duration != 0)
+        {
+            Trace(TraceBuffer::DoWork, (int32_t)duration, (int32_t)_inFlightEventCount, (int32_t)_pendingEventCount);
+        }
+    }
+
+    UpdateRetryPolicy();
+    _inCallback = inCallback;
+    RunDeferredCalls();
+}
+
+void IoTHubDevice::Defer(DeferredCall *deferredCall)
+{
+    DList_InsertTailList(&_deferredCallList, &(deferredCall->dlistEntry));
+}
+
+// Calls queued while inside the SDK, and any they queue themselves. Left for the outer DoWork when this
+// one was called from a callback.
+void IoTHubDevice::RunDeferredCalls()
+{
+    while (!_inCallback && !DList_IsListEmpty(&_deferredCallList))
+    {
+        DeferredCall *deferredCall = containingRecord(_deferredCallList.Flink, DeferredCall, dlistEntry);
+
+        // The entry may be gone once called
+        DList_RemoveEntryList(&(deferredCall->dlistEntry));
+        deferredCall->function(deferredCall->userContext);
+    }
+}
+
+// One duty cycle for a device that sleeps between bursts. Connects unless already started, sends everything
+// queued, waits for the device twin if there is a callback or cache to use it, carries on for listenTime ms
+// after that for methods and cloud to device messages, then stops. The in flight limit is lifted for the
+// burst so queued messages are published back to back rather than each waiting for the one before.
+IoTHubDevice::BurstReport IoTHubDevice::RunBurst(unsigned int timeout, unsigned int listenTime)
+{
+    BurstReport report;
+    size_t maxInFlightEvents = _maxInFlightEvents;
+    unsigned long eventsConfirmed = _eventsConfirmed;
+    unsigned long eventsFailed = _eventsFailed;
+    unsigned long messagesReceived = _messagesReceived;
+    unsigned long methodsAnswered = _methodsAnswered;
+    unsigned long bytesSent = _bytesSent;
+    unsigned long bytesReceived = _bytesReceived;
+    tickcounter_ms_t burstStart = GetTickCount();
+    tickcounter_ms_t completeAt = 0;
+    bool complete = false;
+    bool done = false;
+
+    memset(&report, 0, sizeof(report));
+    _maxInFlightEvents = 0;
+
+    if (_deviceHandle == NULL && (report.result = Start()) != 0)
+    {
+        LogError("Failed to start burst");
+    }
+    else
+    {
+        while (!done)
+        {
+            tickcounter_ms_t now;
+
+            DoWork();
+            now = GetTickCount();
+
+            // Anything that arrives while listening, such as a method that queues a reply, restarts the wait
+            if (!IsBurstComplete())
+            {
+                complete = false;
+            }
+            else if (!complete)
+            {
+                complete = true;
+                completeAt = now;
+            }
+
+            if (complete && now - completeAt >= listenTime)
+            {
+                done = true;
+            }
+            else if (now - burstStart >= timeout)
+            {
+                LogError("Burst did not complete in %u ms", timeout);
+                report.result = __FAILURE__;
+                done = true;
+            }
+            else
+            {
+                ThreadAPI_Sleep(BurstPollInterval);
+            }
+        }
+
+        if (_authenticated && _authenticatedAt >= burstStart)
+        {
+            report.connectTime = (unsigned long)(_authenticatedAt - burstStart);
+        }
+    }
+
+    Stop();
+    _maxInFlightEvents = maxInFlightEvents;
+
+    report.radioOnTime = (unsigned long)(GetTickCount() - burstStart);
+    report.eventsSent = (unsigned int)(_eventsConfirmed - eventsConfirmed);
+    report.eventsFailed = (unsigned int)(_eventsFailed - eventsFailed);
+    report.messagesReceived = (unsigned int)(_messagesReceived - messagesReceived);
+    report.methodsAnswered = (unsigned int)(_methodsAnswered - methodsAnswered);
+    report.bytesSent = _bytesSent - bytesSent;
+    report.bytesReceived = _bytesReceived - bytesReceived;
+
+    return report;
+}
+
+bool IoTHubDevice::IsBurstComplete()
+{
+    // The twin is only worth waiting for if something will use it
+    return _authenticated &&
+        !WaitingEvents() &&
+        DList_IsListEmpty(&_outstandingReportedStateEventList) &&
+        (_twinReceived || (_deviceTwinCallback == NULL && !_twinCache.IsEnabled()));
 }
 
 int IoTHubDevice::WaitingEventsCount()
 {
-    PDLIST_ENTRY listEntry = &_outstandingEventList;
-    
-    int count = 0;
+    return (int)(_inFlightEventCount + _pendingEventCount);
+}
+
+int IoTHubDevice::PendingEventsCount()
+{
+    return (int)_pendingEventCount;
+}
 
-    while (listEntry->Flink != &_outstandingEventList)
+void IoTHubDevice::SetMessageTimeToLive(unsigned int milliseconds)
+{
+    _messageTimeToLive = milliseconds;
+
+    // Also applies to messages already handed to the SDK - these are reported with ConfirmationMessageTimeout
+    if (_deviceHandle != NULL)
     {
-        count++;
-        listEntry = listEntry->Flink;
+        tickcounter_ms_t messageTimeout = _messageTimeToLive;
+
+        IoTHubClient_LL_SetOption(GetHandle(), OPTION_MESSAGE_TIMEOUT, &messageTimeout);
     }
+}
 
-    return count;
+void IoTHubDevice::SetMaxPendingEvents(size_t value, OverflowPolicy overflowPolicy)
+{
+    _maxPendingEvents = value;
+    _overflowPolicy = overflowPolicy;
+}
+
+tickcounter_ms_t IoTHubDevice::GetTickCount()
+{
+    tickcounter_ms_t result = 0;
+
+    if (_tickCounter == NULL || tickcounter_get_current_ms(_tickCounter, &result) != 0)
+    {
+        LogError("Failed to read tick counter");
+    }
+
+    return result;
+}
+
+void IoTHubDevice::SetSasTokenLifetime(size_t seconds)
+{
+    _sasTokenLifetime = seconds;
+
+    if (_deviceHandle != NULL)
+    {
+        IoTHubClient_LL_SetOption(GetHandle(), OPTION_SAS_TOKEN_LIFETIME, &_sasTokenLifetime);
+    }
+}
+
+void IoTHubDevice::BeginStartupPhase(StartupPhase phase)
+{
+    StartupPhaseTiming &timing = _startupProfile.phases[phase];
+
+    if (!timing.started)
+    {
+        timing.started = true;
+        timing.start = (unsigned long)(GetTickCount() - _startedAt);
+    }
+}
+
+void IoTHubDevice::EndStartupPhase(StartupPhase phase)
+{
+    StartupPhaseTiming &timing = _startupProfile.phases[phase];
+
+    if (timing.started && !timing.complete)
+    {
+        timing.complete = true;
+        timing.end = (unsigned long)(GetTickCount() - _startedAt);
+    }
+}
+
+const char *IoTHubDevice::GetStartupPhaseName(StartupPhase phase)
+{
+    static const char *names[StartupPhaseCount] = 
+    {
+        "parseConnectionString",
+        "platformInit",
+        "createClient",
+        "setOptions",
+        "firstDoWork",
+        "connect",
+        "firstTwin",
+        "firstEvent",
+    };
+
+    return (phase >= 0 && phase < StartupPhaseCount) ? names[phase] : NULL;
+}
+
+// Writes the profile as JSON, phases that have not completed are null. Returns the length written
+// or -1 if the buffer is too small.
+int IoTHubDevice::FormatStartupProfile(char *buffer, size_t size)
+{
+    int result = 0;
+    int length = snprintf(buffer, size, "{");
+
+    for (int i = 0; i < StartupPhaseCount && length >= 0 && (size_t)length < size; i++)
+    {
+        const StartupPhaseTiming &timing = _startupProfile.phases[i];
+
+        if (timing.complete)
+        {
+            length += snprintf(buffer + length, size - length, "\"%s\":{\"start\":%lu,\"end\":%lu},", 
+                GetStartupPhaseName((StartupPhase)i), timing.start, timing.end);
+        }
+        else
+        {
+            length += snprintf(buffer + length, size - length, "\"%s\":null,", GetStartupPhaseName((StartupPhase)i));
+        }
+    }
+
+    if (length >= 0 && (size_t)length < size)
+    {
+        length += snprintf(buffer + length, size - length, "\"connectDoWorkTime\":%lu,\"connectDoWorkCalls\":%u}",
+            _startupProfile.connectDoWorkTime, _startupProfile.connectDoWorkCalls);
+    }
+
+    if (length < 0 || (size_t)length >= size)
+    {
+        LogError("Startup profile does not fit in %d bytes", (int)size);
+        result = -1;
+    }
+    else
+    {
+        result = length;
+    }
+
+    return result;
+}
+
+size_t IoTHubDevice::GetMessageSize(IOTHUB_MESSAGE_HANDLE message)
+{
+    const unsigned char *buffer;
+    const char *string;
+    size_t result = 0;
+
+    if (IoTHubMessage_GetContentType(message) == IOTHUBMESSAGE_BYTEARRAY)
+    {
+        if (IoTHubMessage_GetByteArray(message, &buffer, &result) != IOTHUB_MESSAGE_OK)
+        {
+            result = 0;
+        }
+    }
+    else if ((string = IoTHubMessage_GetString(message)) != NULL)
+    {
+        result = strlen(string);
+    }
+
+    return result;
+}
+
+void IoTHubDevice::SetTraceBuffer(TraceBuffer *traceBuffer)
+{
+    _traceBuffer = traceBuffer;
+
+    if (_traceBuffer != NULL)
+    {
+        _traceBuffer->Begin();
+    }
+}
+
+void IoTHubDevice::Trace(uint32_t event, int32_t arg0, int32_t arg1, int32_t arg2)
+{
+    if (_traceBuffer != NULL && _tickCounter != NULL)
+    {
+        _traceBuffer->Add((uint32_t)GetTickCount(), event, arg0, arg1, arg2);
+    }
+}
+
+bool IoTHubDevice::CanSubmitEvent()
+{
+    return _authenticated && 
+        (_maxInFlightEvents == 0 || _inFlightEventCount < _maxInFlightEvents) &&
+        !IsSasTokenRenewalDue();
+}
+
+// A SAS token renewal is a planned disconnect so there is no reason to back off before reconnecting. The
+// policy is switched here rather than in the SDK's connection status callback and put back once the device
+// has authenticated again.
+void IoTHubDevice::UpdateRetryPolicy()
+{
+    if (_renewingSasToken && !_immediateRetry)
+    {
+        if (IoTHubClient_LL_GetRetryPolicy(GetHandle(), &_retryPolicy, &_retryTimeout) != IOTHUB_CLIENT_OK ||
+            IoTHubClient_LL_SetRetryPolicy(GetHandle(), IOTHUB_CLIENT_RETRY_IMMEDIATE, _retryTimeout) != IOTHUB_CLIENT_OK)
+        {
+            LogError("Failed to set immediate retry for SAS token renewal");
+        }
+
+        // Set even on failure so that the error is not repeated on every DoWork
+        _immediateRetry = true;
+    }
+    else if (!_renewingSasToken && _immediateRetry)
+    {
+        if (IoTHubClient_LL_SetRetryPolicy(GetHandle(), _retryPolicy, _retryTimeout) != IOTHUB_CLIENT_OK)
+        {
+            LogError("Failed to restore retry policy after SAS token renewal");
+        }
+
+        _immediateRetry = false;
+    }
+}
+
+bool IoTHubDevice::IsSasTokenRenewalDue()
+{
+    bool result = false;
+
+    if (_usesSasKey && _sasTokenRenewalMargin != 0 && _authenticated)
+    {
+        // MQTT cannot present a new token without reconnecting. The SDK does this once 80% of the 
+        // token lifetime has passed so new messages are held back for the margin either side of 
+        // that point, letting those in flight be acknowledged before the connection is cycled.
+        size_t lifetime = DefaultSasTokenLifetime;
+
+        if (_sasTokenLifetime != 0)
+        {
+            lifetime = _sasTokenLifetime;
+        }
+
+        tickcounter_ms_t renewAt = _authenticatedAt + (tickcounter_ms_t)lifetime * 800;
+        tickcounter_ms_t margin = (tickcounter_ms_t)_sasTokenRenewalMargin * 1000;
+        tickcounter_ms_t now = GetTickCount();
+
+        result = now + margin >= renewAt && now < renewAt + margin;
+    }
+
+    return result;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubDevice::SubmitEvent(MessageUserContext *messageUC, IOTHUB_MESSAGE_HANDLE message)
+{
+    IOTHUB_CLIENT_RESULT result;
+
+    result = IoTHubClient_LL_SendEventAsync(GetHandle(), message, InternalEventConfirmationCallback, messageUC);
+
+    if (result == IOTHUB_CLIENT_OK)
+    {
+        DList_InsertTailList(&_outstandingEventList, &(messageUC->dlistEntry));
+        _inFlightEventCount++;
+        _bytesSent += GetMessageSize(message);
+        BeginStartupPhase(FirstEvent);
+
+        if (_traceBuffer != NULL)
+        {
+            messageUC->submittedAt = GetTickCount();
+        }
+    }
+
+    Trace(TraceBuffer::Submit, (int32_t)messageUC->id, result, (int32_t)_inFlightEventCount);
+
+    return result;
+}
+
+void IoTHubDevice::SubmitPendingEvents()
+{
+    while (!DList_IsListEmpty(&_pendingEventList) && CanSubmitEvent())
+    {
+        MessageUserContext *messageUC = containingRecord(DList_RemoveHeadList(&_pendingEventList), MessageUserContext, dlistEntry);
+        IOTHUB_MESSAGE_HANDLE message = messageUC->message;
+
+        _pendingEventCount--;
+        messageUC->message = NULL;
+
+        if (SubmitEvent(messageUC, message) != IOTHUB_CLIENT_OK)
+        {
+            LogError("Failed to send queued message");
+            _eventsFailed++;
+
+            if (messageUC->eventConfirmationCallback != NULL)
+            {
+                messageUC->eventConfirmationCallback(*this, ConfirmationError, messageUC->userContext);
+            }
+
+            _messageUserContexts.Destroy(messageUC);
+        }
+
+        // The SDK holds its own copy
+        IoTHubMessage_Destroy(message);
+    }
+}
+
+void IoTHubDevice::PurgeExpiredEvents()
+{
+    if (!DList_IsListEmpty(&_pendingEventList))
+    {
+        tickcounter_ms_t now = GetTickCount();
+        PDLIST_ENTRY listEntry = _pendingEventList.Flink;
+
+        while (listEntry != &_pendingEventList)
+        {
+            MessageUserContext *messageUC = containingRecord(listEntry, MessageUserContext, dlistEntry);
+
+            listEntry = listEntry->Flink;
+
+            if (messageUC->expiry != 0 && messageUC->expiry <= now)
+            {
+                DiscardPendingEvent(messageUC, ConfirmationExpired);
+            }
+        }
+    }
+}
+
+void IoTHubDevice::DiscardPendingEvent(MessageUserContext *messageUC, ConfirmationResult result)
+{
+    // Unlink first so the callback is free to queue another message
+    DList_RemoveEntryList(&(messageUC->dlistEntry));
+    _pendingEventCount--;
+    IoTHubMessage_Destroy(messageUC->message);
+    Trace(TraceBuffer::Discard, (int32_t)messageUC->id, result);
+    _eventsFailed++;
+
+    if (messageUC->eventConfirmationCallback != NULL)
+    {
+        messageUC->eventConfirmationCallback(*this, result, messageUC->userContext);
+    }
+
+    _messageUserContexts.Destroy(messageUC);
+}
+
+IoTHubDevice::ConfirmationResult IoTHubDevice::GetConfirmationResult(IOTHUB_CLIENT_CONFIRMATION_RESULT result)
+{
+    ConfirmationResult confirmationResult = ConfirmationError;
+
+    switch (result)
+    {
+    case IOTHUB_CLIENT_CONFIRMATION_OK:
+        confirmationResult = ConfirmationOk;
+        break;
+    case IOTHUB_CLIENT_CONFIRMATION_BECAUSE_DESTROY:
+        confirmationResult = ConfirmationBecauseDestroy;
+        break;
+    case IOTHUB_CLIENT_CONFIRMATION_MESSAGE_TIMEOUT:
+        confirmationResult = ConfirmationMessageTimeout;
+        break;
+    default:
+        break;
+    }
+
+    return confirmationResult;
 }
 
 void IoTHubDevice::SetLogging(bool value)
@@ -364,13 +1150,20 @@ IOTHUBMESSAGE_DISPOSITION_RESULT IoTHubDevice::InternalMessageCallback(IOTHUB_ME
     IoTHubDevice *that = (IoTHubDevice *)userContext;
     IOTHUBMESSAGE_DISPOSITION_RESULT result = IOTHUBMESSAGE_REJECTED;
 
+    that->_messagesReceived++;
+    that->_bytesReceived += GetMessageSize(message);
+
     if (that->_messageCallback != NULL)
     {
-        IoTHubMessage *msg = new IoTHubMessage(message);
+        IoTHubMessage msg(message);
+        tickcounter_ms_t callbackStart = (that->_traceBuffer != NULL) ? that->GetTickCount() : 0;
 
-        result = that->_messageCallback(*that, *msg, that->_messageCallbackUC);
+        result = that->_messageCallback(*that, msg, that->_messageCallbackUC);
 
-        delete msg;
+        if (that->_traceBuffer != NULL)
+        {
+            that->Trace(TraceBuffer::MessageCallback, result, (int32_t)(that->GetTickCount() - callbackStart));
+        }
     }
 
     return result;
@@ -380,6 +1173,30 @@ void IoTHubDevice::InternalConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_STA
 {
     IoTHubDevice *that = (IoTHubDevice *)userContext;
 
+    that->_authenticated = (result == IOTHUB_CLIENT_CONNECTION_AUTHENTICATED);
+    that->Trace(TraceBuffer::ConnectionStatus, result, reason);
+
+    if (that->_authenticated)
+    {
+        that->_authenticatedAt = that->GetTickCount();
+        that->EndStartupPhase(Connect);
+        that->BeginStartupPhase(FirstTwin);
+
+        // DoWork puts the retry policy back
+        if (that->_renewingSasToken)
+        {
+            that->_renewingSasToken = false;
+            that->_sasTokenRenewalCount++;
+            that->_lastSasTokenRenewalDuration = that->_authenticatedAt - that->_sasTokenRenewalStartedAt;
+        }
+    }
+    else if (reason == IOTHUB_CLIENT_CONNECTION_EXPIRED_SAS_TOKEN && that->_usesSasKey && !that->_renewingSasToken)
+    {
+        // A planned disconnect to renew the token. DoWork switches to immediate retry once the SDK returns.
+        that->_renewingSasToken = true;
+        that->_sasTokenRenewalStartedAt = that->GetTickCount();
+    }
+
     if (that->_connectionStatusCallback != NULL)
     {
         that->_connectionStatusCallback(*that, result, reason, that->_connectionStatusCallbackUC);
@@ -390,39 +1207,56 @@ void IoTHubDevice::InternalEventConfirmationCallback(IOTHUB_CLIENT_CONFIRMATION_
 {
     MessageUserContext *messageUC = (MessageUserContext *)userContext;
 
+    if (result == IOTHUB_CLIENT_CONFIRMATION_OK)
+    {
+        messageUC->iotHubDevice->EndStartupPhase(FirstEvent);
+        messageUC->iotHubDevice->_eventsConfirmed++;
+    }
+    else
+    {
+        messageUC->iotHubDevice->_eventsFailed++;
+    }
+
+    if (messageUC->iotHubDevice->_traceBuffer != NULL)
+    {
+        messageUC->iotHubDevice->Trace(TraceBuffer::Confirmation, (int32_t)messageUC->id, result, (int32_t)(messageUC->iotHubDevice->GetTickCount() - messageUC->submittedAt));
+    }
+
     if (messageUC->eventConfirmationCallback != NULL)
     {
-        messageUC->eventConfirmationCallback(*(messageUC->iotHubDevice), result, messageUC->userContext);
+        messageUC->eventConfirmationCallback(*(messageUC->iotHubDevice), GetConfirmationResult(result), messageUC->userContext);
     }
 
     DList_RemoveEntryList(&(messageUC->dlistEntry));    
-    delete messageUC;
+    messageUC->iotHubDevice->_inFlightEventCount--;
+    messageUC->iotHubDevice->_messageUserContexts.Destroy(messageUC);
 }
 
 void IoTHubDevice::InternalReportedStateCallback(int status_code, void* userContext)
 {
     ReportedStateUserContext *reportedStateUC = (ReportedStateUserContext *)userContext;
 
+    reportedStateUC->iotHubDevice->Trace(TraceBuffer::ReportedStateCallback, status_code);
+
     if (reportedStateUC->reportedStateCallback != NULL)
     {
         reportedStateUC->reportedStateCallback(*(reportedStateUC->iotHubDevice), status_code, reportedStateUC->userContext);
     }
 
     DList_RemoveEntryList(&(reportedStateUC->dlistEntry));
-    delete reportedStateUC;
+    reportedStateUC->iotHubDevice->_reportedStateUserContexts.Destroy(reportedStateUC);
 }
 
 int IoTHubDevice::InternalDeviceMethodCallback(const char *methodName, const unsigned char *payload, size_t size, unsigned char **response, size_t *responseSize, void *userContext)
 {
     IoTHubDevice *that = (IoTHubDevice *)userContext;
-    map<std::string, DeviceMethodUserContext *>::iterator it;
+    DeviceMethodUserContext *deviceMethodUserContext = that->_deviceMethods.Find(methodName);
+    tickcounter_ms_t callbackStart = (that->_traceBuffer != NULL) ? that->GetTickCount() : 0;
     int status = 999;
 
-    it = that->_deviceMethods.find(methodName);
-
-    if (it != that->_deviceMethods.end())
+    if (deviceMethodUserContext != NULL)
     {
-        status = it->second->deviceMethodCallback(*that, payload, size, response, responseSize, it->second->userContext);
+        status = deviceMethodUserContext->deviceMethodCallback(*that, payload, size, response, responseSize, deviceMethodUserContext->userContext);
     }
     else if (that->_unknownDeviceMethodCallback != NULL)
     {
@@ -445,6 +1279,19 @@ int IoTHubDevice::InternalDeviceMethodCallback(const char *methodName, const uns
         }
     }
 
+    that->_methodsAnswered++;
+    that->_bytesReceived += size;
+
+    if (*response != NULL)
+    {
+        that->_bytesSent += *responseSize;
+    }
+
+    if (that->_traceBuffer != NULL)
+    {
+        that->Trace(TraceBuffer::MethodCallback, status, (int32_t)size, (int32_t)(that->GetTickCount() - callbackStart));
+    }
+
     return status;    
 }
 
@@ -452,14 +1299,68 @@ void IoTHubDevice::InternalDeviceTwinCallback(DEVICE_TWIN_UPDATE_STATE update_st
 {
     IoTHubDevice *that = (IoTHubDevice *)userContext;
 
-    if (that->_deviceTwinCallback != NULL)
+    if (update_state == DEVICE_TWIN_UPDATE_COMPLETE)
     {
+        that->EndStartupPhase(FirstTwin);
+    }
+
+    that->Trace(TraceBuffer::TwinCallback, update_state, (int32_t)size);
+    that->_bytesReceived += size;
+
+    if (that->_deviceTwinCallback != NULL || that->_twinCache.IsEnabled())
+    {
+#ifdef IOTHUB_STATIC_CONFIG
+        if (size > IOTHUB_MAX_TWIN_SIZE)
+        {
+            LogError("Device twin of %d bytes exceeds IOTHUB_MAX_TWIN_SIZE", (int)size);
+        }
+        else
+        {
+            memcpy(that->_twinBuffer, payLoad, size);
+            that->_twinBuffer[size] = '\0';
+            that->DeliverDeviceTwin(update_state, that->_twinBuffer);
+        }
+#else
         char *json = new char[size + 1];
 
         memcpy(json, payLoad, size);
         json[size] = '\0';
-        that->_deviceTwinCallback(update_state, json, that->_deviceTwinCallbackUC);
+        that->DeliverDeviceTwin(update_state, json);
         delete [] json;
+#endif
+    }
+}
+
+void IoTHubDevice::ApplyCachedTwin()
+{
+    if (_deviceTwinCallback != NULL && !_twinCacheApplied && !_twinReceived && _twinCache.IsLoaded())
+    {
+        char *json = _twinCache.Serialize();
+
+        if (json != NULL)
+        {
+            _twinCacheApplied = true;
+            _deviceTwinCallback(DEVICE_TWIN_UPDATE_COMPLETE, json, _deviceTwinCallbackUC);
+            json_free_serialized_string(json);
+        }
+    }
+}
+
+void IoTHubDevice::DeliverDeviceTwin(DEVICE_TWIN_UPDATE_STATE update_state, const char *json)
+{
+    bool changed = true;
+
+    // A complete twin whose desired properties match the cache the handler already ran from is not passed on
+    if (_twinCache.IsEnabled())
+    {
+        changed = _twinCache.Update(update_state, json) || !_twinCacheApplied;
+    }
+
+    _twinReceived = true;
+
+    if (_deviceTwinCallback != NULL && changed)
+    {
+        _deviceTwinCallback(update_state, json, _deviceTwinCallbackUC);
     }
 }
 
@@ -1,19 +1,33 @@
 #ifndef _IOTHUBDEVICE_H
 #define _IOTHUBDEVICE_H
 
-#include <string>
-#include <map>
-
+#include "IoTHubConfig.h"
 #include "IoTHubMessage.h"
+#include "TwinCache.h"
 
 #include <AzureIoTHub.h>
 #include "azure_c_shared_utility/doublylinkedlist.h"
+#include "azure_c_shared_utility/tickcounter.h"
+
+class TraceBuffer;
 
 class IoTHubDevice
 {
 public:
+    // Passed to EventConfirmationCallback. The first four are the SDK's IOTHUB_CLIENT_CONFIRMATION_RESULT
+    // values, the others are raised by the wrapper itself for messages that never reached the hub.
+    enum ConfirmationResult
+    {
+        ConfirmationOk,
+        ConfirmationBecauseDestroy,
+        ConfirmationMessageTimeout,
+        ConfirmationError,
+        ConfirmationExpired,            // Time to live ran out while the message was still queued
+        ConfirmationDropped,            // Dropped from a full pending queue
+    };
+
     typedef IOTHUBMESSAGE_DISPOSITION_RESULT (*MessageCallback)(IoTHubDevice &iotHubDevice, IoTHubMessage &iotHubMessage, void *userContext);
-    typedef void (*EventConfirmationCallback)(IoTHubDevice &iotHubDevice, IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *userContext);
+    typedef void (*EventConfirmationCallback)(IoTHubDevice &iotHubDevice, ConfirmationResult result, void *userContext);
     typedef void (*ConnectionStatusCallback)(IoTHubDevice &iotHubDevice, IOTHUB_CLIENT_CONNECTION_STATUS result, IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason, void *userContext);
     typedef int (*DeviceMethodCallback)(IoTHubDevice &iotHubDevice, const unsigned char *payload, size_t size, unsigned char** response, size_t* resp_size, void* userContext);
     typedef int (*UnknownDeviceMethodCallback)(IoTHubDevice &iotHubDevice, const char *methodName, const unsigned char *payload, size_t size, unsigned char** response, size_t* resp_size, void* userContext);
@@ -28,8 +42,12 @@ private:
         IoTHubDevice *iotHubDevice;
         EventConfirmationCallback eventConfirmationCallback;
         void *userContext;
+        IOTHUB_MESSAGE_HANDLE message;
+        tickcounter_ms_t expiry;
+        uint32_t id;
+        tickcounter_ms_t submittedAt;
         MessageUserContext(IoTHubDevice *iotHubDevice, EventConfirmationCallback eventConfirmationCallback, void *userContext) :
-            iotHubDevice(iotHubDevice), eventConfirmationCallback(eventConfirmationCallback), userContext(userContext)
+            iotHubDevice(iotHubDevice), eventConfirmationCallback(eventConfirmationCallback), userContext(userContext), message(NULL), expiry(0), id(0), submittedAt(0)
         {
             dlistEntry = { 0 };
         }
@@ -52,7 +70,7 @@ private:
     {
         DeviceMethodCallback deviceMethodCallback;
         void *userContext;
-        DeviceMethodUserContext(DeviceMethodCallback deviceMethodCallback, void *userContext) :
+        DeviceMethodUserContext(DeviceMethodCallback deviceMethodCallback = NULL, void *userContext = NULL) :
             deviceMethodCallback(deviceMethodCallback), userContext(userContext)
         {
         }
@@ -74,9 +92,16 @@ private:
     void *_deviceTwinCallbackUC;
 
     DLIST_ENTRY _outstandingEventList;
+    DLIST_ENTRY _pendingEventList;
     DLIST_ENTRY _outstandingReportedStateEventList;
-    std::map<std::string, DeviceMethodUserContext *> _deviceMethods;
-    MapUtil *_parsedCS;
+    DLIST_ENTRY _deferredCallList;
+    IoTHubStringMap<DeviceMethodUserContext, IOTHUB_MAX_DEVICE_METHODS> _deviceMethods;
+    IoTHubPool<MessageUserContext, IOTHUB_MAX_EVENTS> _messageUserContexts;
+    IoTHubPool<ReportedStateUserContext, IOTHUB_MAX_REPORTED_STATES> _reportedStateUserContexts;
+    MapUtil _parsedCS;
+#ifdef IOTHUB_STATIC_CONFIG
+    char _twinBuffer[IOTHUB_MAX_TWIN_SIZE + 1];
+#endif
 
 public:
     enum Protocol
@@ -84,6 +109,72 @@ public:
         MQTT,
     };
 
+    // What to do with a new message when the pending queue is full. Dropped messages, oldest or newest, are
+    // reported to their EventConfirmationCallback with ConfirmationDropped and SendEventAsync
+    // returns IOTHUB_CLIENT_OK. Block calls DoWork until there is space, for at most the block timeout or
+    // the message's time to live if that is shorter, and returns IOTHUB_CLIENT_ERROR if there is still
+    // none. It cannot wait when called from a callback, as DoWork is not reentrant, and fails at once.
+    enum OverflowPolicy
+    {
+        DropOldest,
+        DropNewest,
+        Block,
+    };
+
+    // Start up phases timed by the startup profile, in the order they complete. DNS, TCP, TLS and the MQTT
+    // CONNECT all happen inside the SDK's DoWork and are timed together as Connect.
+    enum StartupPhase
+    {
+        ParseConnectionString,
+        PlatformInit,
+        CreateClient,
+        SetOptions,
+        FirstDoWork,                // Start returning to the first call to DoWork
+        Connect,                    // First call to DoWork to authenticated
+        FirstTwin,                  // Authenticated to the complete twin (twin subscription and GET)
+        FirstEvent,                 // First message handed to the SDK to its confirmation
+        StartupPhaseCount,
+    };
+
+    // Times are milliseconds after Start was called
+    struct StartupPhaseTiming
+    {
+        bool started;
+        bool complete;
+        unsigned long start;
+        unsigned long end;
+    };
+
+    struct StartupProfile
+    {
+        StartupPhaseTiming phases[StartupPhaseCount];
+        unsigned long connectDoWorkTime;    // Time spent inside the SDK's DoWork until authenticated
+        unsigned int connectDoWorkCalls;
+    };
+
+    // Result of RunBurst. Byte counts are application payloads, not including MQTT and TLS overhead.
+    struct BurstReport
+    {
+        int result;                         // 0 if everything was confirmed before the timeout
+        unsigned long radioOnTime;          // ms from the start of the burst to the end of Stop
+        unsigned long connectTime;          // ms from the start of the burst to authenticated
+        unsigned int eventsSent;            // Messages confirmed by the hub
+        unsigned int eventsFailed;          // Messages that failed, expired, were dropped or were still waiting at the end
+        unsigned int messagesReceived;
+        unsigned int methodsAnswered;
+        unsigned long bytesSent;            // Messages, reported state and method responses
+        unsigned long bytesReceived;        // Messages, device twin and method requests
+    };
+
+    // Work to be run once DoWork or Stop has returned from the SDK, such as resuming a coroutine (see
+    // IoTHubAwaitable.h). The owner keeps the entry alive until function has been called.
+    struct DeferredCall
+    {
+        DLIST_ENTRY dlistEntry;
+        void (*function)(void *userContext);
+        void *userContext;
+    };
+
     IoTHubDevice(const char *connectionString, IoTHubDevice::Protocol protocol = IoTHubDevice::Protocol::MQTT);
     IoTHubDevice(const char *connectionString, 
                  const char *x509Certificate,
@@ -97,33 +188,139 @@ public:
     const char *GetHostName();
     const char *GetDeviceId();
     const char *GetVersion();
+    MessageCallback GetMessageCallback() { return _messageCallback; }
+    void *GetMessageCallbackContext() { return _messageCallbackUC; }
     MessageCallback SetMessageCallback(MessageCallback messageCallback, void *userContext = NULL);
     ConnectionStatusCallback SetConnectionStatusCallback(ConnectionStatusCallback ConnectionStatusCallback, void *userContext = NULL);
+    // Returns the previous callback for methodName, or DeviceMethodNotRegistered if there was no room for
+    // a new method (see IOTHUB_MAX_DEVICE_METHODS) or its name is too long
     DeviceMethodCallback SetDeviceMethodCallback(const char *methodName, DeviceMethodCallback deviceMethodCallback, void *userContext = NULL);
+    static int DeviceMethodNotRegistered(IoTHubDevice &iotHubDevice, const unsigned char *payload, size_t size, unsigned char **response, size_t *resp_size, void *userContext);
     UnknownDeviceMethodCallback SetUnknownDeviceMethodCallback(UnknownDeviceMethodCallback unknownDeviceMethodCallback, void *userContext = NULL);
     DeviceTwinCallback SetDeviceTwinCallback(DeviceTwinCallback deviceTwinCallback, void *userContext = NULL);
 
     IOTHUB_CLIENT_LL_HANDLE GetHandle() const;
-    bool WaitingEvents() { return !DList_IsListEmpty(&_outstandingEventList); }
+    bool WaitingEvents() { return !DList_IsListEmpty(&_outstandingEventList) || !DList_IsListEmpty(&_pendingEventList); }
     int WaitingEventsCount();
+    int PendingEventsCount();
+    unsigned int GetMessageTimeToLive() { return _messageTimeToLive; }
+    void SetMessageTimeToLive(unsigned int milliseconds);
+    size_t GetMaxPendingEvents() { return _maxPendingEvents; }
+    OverflowPolicy GetOverflowPolicy() { return _overflowPolicy; }
+    void SetMaxPendingEvents(size_t value, OverflowPolicy overflowPolicy = DropOldest);
+    unsigned int GetBlockTimeout() { return _blockTimeout; }
+    void SetBlockTimeout(unsigned int milliseconds) { _blockTimeout = milliseconds; }
+    size_t GetMaxInFlightEvents() { return _maxInFlightEvents; }
+    void SetMaxInFlightEvents(size_t value) { _maxInFlightEvents = value; }
+    size_t GetSasTokenLifetime() { return _sasTokenLifetime; }
+    void SetSasTokenLifetime(size_t seconds);
+    size_t GetSasTokenRenewalMargin() { return _sasTokenRenewalMargin; }
+    void SetSasTokenRenewalMargin(size_t seconds) { _sasTokenRenewalMargin = seconds; }
+    unsigned long GetSasTokenRenewalCount() { return _sasTokenRenewalCount; }
+    unsigned long GetLastSasTokenRenewalDuration() { return (unsigned long)_lastSasTokenRenewalDuration; }
+    const char *GetTwinCacheFile() { return _twinCache.GetFileName(); }
+    void SetTwinCacheFile(const char *fileName) { _twinCache.SetFileName(fileName); }
+    const StartupProfile &GetStartupProfile() { return _startupProfile; }
+    int FormatStartupProfile(char *buffer, size_t size);
+    static const char *GetStartupPhaseName(StartupPhase phase);
+    TraceBuffer *GetTraceBuffer() { return _traceBuffer; }
+    void SetTraceBuffer(TraceBuffer *traceBuffer);
+    unsigned long GetBytesSent() { return _bytesSent; }
+    unsigned long GetBytesReceived() { return _bytesReceived; }
     bool GetLogging() { return _logging; }
     void SetLogging(bool value);
 	const char *GetTrustedCertificate() { return _certificate; }
 	void SetTrustedCertificate(const char *value);
     IOTHUB_CLIENT_STATUS GetSendStatus();
-    IOTHUB_CLIENT_RESULT SendEventAsync(const std::string &message, EventConfirmationCallback eventConfirmationCallback, void *userContext = NULL);
-    IOTHUB_CLIENT_RESULT SendEventAsync(const char *message, EventConfirmationCallback eventConfirmationCallback, void *userContext = NULL);
-    IOTHUB_CLIENT_RESULT SendEventAsync(const uint8_t *message, size_t length, EventConfirmationCallback eventConfirmationCallback, void *userContext = NULL);
-    IOTHUB_CLIENT_RESULT SendEventAsync(const IoTHubMessage *message, EventConfirmationCallback eventConfirmationCallback, void *userContext = NULL);
+
+    // A timeToLive given here only applies while the message waits in the pending queue. Once it has been
+    // handed to the SDK it is bound by SetMessageTimeToLive, as the SDK's message timeout is per client.
+#ifndef IOTHUB_STATIC_CONFIG
+    IOTHUB_CLIENT_RESULT SendEventAsync(const std::string &message, EventConfirmationCallback eventConfirmationCallback, void *userContext = NULL, unsigned int timeToLive = 0);
+#endif
+    IOTHUB_CLIENT_RESULT SendEventAsync(const char *message, EventConfirmationCallback eventConfirmationCallback, void *userContext = NULL, unsigned int timeToLive = 0);
+    IOTHUB_CLIENT_RESULT SendEventAsync(const uint8_t *message, size_t length, EventConfirmationCallback eventConfirmationCallback, void *userContext = NULL, unsigned int timeToLive = 0);
+    IOTHUB_CLIENT_RESULT SendEventAsync(const IoTHubMessage *message, EventConfirmationCallback eventConfirmationCallback, void *userContext = NULL, unsigned int timeToLive = 0);
+    // Updates still waiting for the hub when Stop is called are reported with status -1
     IOTHUB_CLIENT_RESULT SendReportedState(const char* reportedState, ReportedStateCallback reportedStateCallback, void* userContext = NULL);
 
+    void Defer(DeferredCall *deferredCall);
+
     void DoWork();
+    BurstReport RunBurst(unsigned int timeout, unsigned int listenTime = 0);
 private:
     const char *_connectionString;
     const char *_x509Certificate;
     const char *_x509PrivateKey;
     IoTHubDevice::Protocol _protocol;
 
+    // Pending queue and message expiry
+    TICK_COUNTER_HANDLE _tickCounter;
+    unsigned int _messageTimeToLive;
+    size_t _maxPendingEvents;
+    size_t _maxInFlightEvents;
+    OverflowPolicy _overflowPolicy;
+    static const unsigned int DefaultBlockTimeout = 10000;
+    unsigned int _blockTimeout;
+    bool _inCallback;                   // DoWork or Stop may be calling back into the application
+    bool _authenticated;
+    size_t _pendingEventCount;
+    size_t _inFlightEventCount;
+
+    // SAS token renewal
+    static const size_t DefaultSasTokenLifetime = 3600;
+    bool _usesSasKey;
+    size_t _sasTokenLifetime;
+    size_t _sasTokenRenewalMargin;
+    tickcounter_ms_t _authenticatedAt;
+    bool _renewingSasToken;
+    tickcounter_ms_t _sasTokenRenewalStartedAt;
+    IOTHUB_CLIENT_RETRY_POLICY _retryPolicy;
+    size_t _retryTimeout;
+    bool _immediateRetry;                   // _retryPolicy holds the policy to restore after a renewal
+    unsigned long _sasTokenRenewalCount;
+    tickcounter_ms_t _lastSasTokenRenewalDuration;
+
+    // Device twin cache
+    TwinCache _twinCache;
+    bool _twinCacheApplied;
+    bool _twinReceived;
+
+    // Startup profile
+    tickcounter_ms_t _startedAt;
+    StartupProfile _startupProfile;
+
+    // Tracing
+    TraceBuffer *_traceBuffer;
+    uint32_t _nextMessageId;
+
+    // Traffic counters
+    static const unsigned int BurstPollInterval = 10;
+    unsigned long _eventsConfirmed;
+    unsigned long _eventsFailed;
+    unsigned long _messagesReceived;
+    unsigned long _methodsAnswered;
+    unsigned long _bytesSent;
+    unsigned long _bytesReceived;
+
+    tickcounter_ms_t GetTickCount();
+    bool CanSubmitEvent();
+    bool IsSasTokenRenewalDue();
+    void UpdateRetryPolicy();
+    void BeginStartupPhase(StartupPhase phase);
+    void EndStartupPhase(StartupPhase phase);
+    void Trace(uint32_t event, int32_t arg0 = 0, int32_t arg1 = 0, int32_t arg2 = 0);
+    void ApplyCachedTwin();
+    void DeliverDeviceTwin(DEVICE_TWIN_UPDATE_STATE update_state, const char *json);
+    IOTHUB_CLIENT_RESULT SubmitEvent(MessageUserContext *messageUC, IOTHUB_MESSAGE_HANDLE message);
+    void SubmitPendingEvents();
+    void PurgeExpiredEvents();
+    void RunDeferredCalls();
+    void DiscardPendingEvent(MessageUserContext *messageUC, ConfirmationResult result);
+    bool IsBurstComplete();
+    static size_t GetMessageSize(IOTHUB_MESSAGE_HANDLE message);
+    static ConfirmationResult GetConfirmationResult(IOTHUB_CLIENT_CONFIRMATION_RESULT result);
+
     // Cloud to device messages
     static IOTHUBMESSAGE_DISPOSITION_RESULT InternalMessageCallback(IOTHUB_MESSAGE_HANDLE message, void *userContext);
 
@@ -1,18 +1,18 @@
-#include <stdexcept>
-
 #include "IoTHubMessage.h"
 
 using namespace std;
 
-IoTHubMessage::IoTHubMessage()
+IoTHubMessage::IoTHubMessage() : _handle(NULL), _isOwned(false)
 {
-    throw runtime_error("Default constructor for IoTHubMessage should not be called");
+    IOTHUB_THROW("Default constructor for IoTHubMessage should not be called");
 }
 
+#ifndef IOTHUB_STATIC_CONFIG
 IoTHubMessage::IoTHubMessage(const std::string &message) : IoTHubMessage(message.c_str())
 {
 
 }
+#endif
 
 IoTHubMessage::IoTHubMessage(const char *message)
 {
@@ -20,7 +20,7 @@ IoTHubMessage::IoTHubMessage(const char *message)
     _handle = IoTHubMessage_CreateFromString(message);
 
     if (_handle == NULL)
-        throw runtime_error("Failed to create IoTHubMessage instance");
+        IOTHUB_THROW("Failed to create IoTHubMessage instance");
 }
 
 IoTHubMessage::IoTHubMessage(const uint8_t *message, size_t length)
@@ -29,7 +29,7 @@ IoTHubMessage::IoTHubMessage(const uint8_t *message, size_t length)
     _handle = IoTHubMessage_CreateFromByteArray(message, length);
 
     if (_handle == NULL)
-        throw runtime_error("Failed to create IoTHubMessage instance");
+        IOTHUB_THROW("Failed to create IoTHubMessage instance");
 }
 
 IoTHubMessage::IoTHubMessage(IOTHUB_MESSAGE_HANDLE handle)
@@ -40,15 +40,16 @@ IoTHubMessage::IoTHubMessage(IOTHUB_MESSAGE_HANDLE handle)
 
 IoTHubMessage::IoTHubMessage(const IoTHubMessage &other)
 {
+    _isOwned = true;
     _handle = IoTHubMessage_Clone(other.GetHandle());
 
     if (_handle == NULL)
-        throw runtime_error("Failed to create IoTHubMessage instance");
+        IOTHUB_THROW("Failed to create IoTHubMessage instance");
 }
 
 IoTHubMessage::~IoTHubMessage()
 {
-    if (_isOwned)
+    if (_isOwned && _handle != NULL)
         IoTHubMessage_Destroy(GetHandle());
 }
 
@@ -64,10 +65,12 @@ const char *IoTHubMessage::GetCString() const
     }
 }
 
+#ifndef IOTHUB_STATIC_CONFIG
 const string IoTHubMessage::GetString() const
 {
     return string(IoTHubMessage_GetString(GetHandle()));
 }
+#endif
 
 IOTHUB_MESSAGE_RESULT IoTHubMessage::GetByteArray(const uint8_t **buffer, size_t *size) const
 {
@@ -89,10 +92,12 @@ const char *IoTHubMessage::GetContentTypeSystemProperty() const
     return IoTHubMessage_GetContentTypeSystemProperty(GetHandle());
 }
 
+#ifndef IOTHUB_STATIC_CONFIG
 MapUtil *IoTHubMessage::GetProperties()
 {
     return new MapUtil(IoTHubMessage_Properties(GetHandle()));
 }
+#endif
 
 IOTHUB_MESSAGE_RESULT IoTHubMessage::SetProperty(const char *key, const char *value)
 {
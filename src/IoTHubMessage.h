@@ -1,7 +1,6 @@
 #ifndef _IOTMESSAGE_H
 #define _IOTMESSAGE_H
 
-#include <string>
 #include <cstdint>
 
 #include <AzureIoTHub.h>
@@ -17,7 +16,9 @@ private:
     IoTHubMessage();
 
 public:
+#ifndef IOTHUB_STATIC_CONFIG
     IoTHubMessage(const std::string &message);
+#endif
     IoTHubMessage(const char *message);
     IoTHubMessage(const uint8_t *message, size_t length);
     IoTHubMessage(IOTHUB_MESSAGE_HANDLE handle);
@@ -25,13 +26,18 @@ public:
     ~IoTHubMessage();
 
     IOTHUB_MESSAGE_HANDLE GetHandle() const { return _handle; }
+    bool IsValid() const { return _handle != NULL; }
     const char *GetCString() const;
+#ifndef IOTHUB_STATIC_CONFIG
     const std::string GetString() const;
+#endif
     IOTHUB_MESSAGE_RESULT GetByteArray(const uint8_t **buffer, size_t *size) const;
     IOTHUBMESSAGE_CONTENT_TYPE GetContentType() const;
     IOTHUB_MESSAGE_RESULT SetContentTypeSystemProperty(const char *contentType);
     const char *GetContentTypeSystemProperty() const;
+#ifndef IOTHUB_STATIC_CONFIG
     MapUtil *GetProperties();
+#endif
     IOTHUB_MESSAGE_RESULT SetProperty(const char *key, const char *value);
     const char *GetProperty(const char *key) const;
     IOTHUB_MESSAGE_RESULT SetMessageId(const char *messageId);
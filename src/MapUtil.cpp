@@ -1,18 +1,18 @@
-#include <stdexcept>
-
 #include "MapUtil.h"
 
 using namespace std;
 
+#ifndef IOTHUB_STATIC_CONFIG
 MapUtil *MapUtil::CreateMap()
 {
     MAP_HANDLE work;
 
     if (NULL == (work = Map_Create(NULL)))
-        throw runtime_error("Failed to create map");
+        IOTHUB_THROW("Failed to create map");
     
     return new MapUtil(work, true);
 }
+#endif
 
 MapUtil::MapUtil(MAP_HANDLE handle, bool isOwned)
 {
@@ -26,7 +26,7 @@ MapUtil::MapUtil(const MapUtil &other)
     _handle = Map_Clone(other.GetHandle());
 
     if (_handle == NULL)
-        throw runtime_error("Failed to clone map");
+        IOTHUB_THROW("Failed to clone map");
 }
 
 MapUtil::~MapUtil()
@@ -35,6 +35,15 @@ MapUtil::~MapUtil()
         Map_Destroy(GetHandle());
 }
 
+void MapUtil::Reset(MAP_HANDLE handle, bool isOwned)
+{
+    if (_isOwned && _handle != NULL)
+        Map_Destroy(_handle);
+
+    _isOwned = isOwned;
+    _handle = handle;
+}
+
 MAP_RESULT MapUtil::Add(const char *key, const char *value)
 {
     return Map_Add(GetHandle(), key, value);
@@ -47,24 +56,24 @@ MAP_RESULT MapUtil::AddOrUpdate(const char *key, const char *value)
 
 bool MapUtil::ContainsKey(const char *key) const
 {
-    bool found;
+    bool found = false;
     MAP_RESULT result = Map_ContainsKey(GetHandle(), key, &found);
 
     if (result != MAP_OK)
-        throw runtime_error("Failed to check for key");
-    else
-        return found;
+        IOTHUB_THROW("Failed to check for key");
+
+    return found;
 }
 
 bool MapUtil::ContainsValue(const char *value) const
 {
-    bool found;
+    bool found = false;
     MAP_RESULT result = Map_ContainsValue(GetHandle(), value, &found);
 
     if (result != MAP_OK)
-        throw runtime_error("Failed to check for value");
-    else
-        return found;
+        IOTHUB_THROW("Failed to check for value");
+
+    return found;
 }
 
 const char *MapUtil::GetValue(const char *key) const
@@ -3,6 +3,8 @@
 
 #include "azure_c_shared_utility/map.h"
 
+#include "IoTHubConfig.h"
+
 class MapUtil
 {
 private:
@@ -11,12 +13,15 @@ private:
 
     MapUtil() {}
 public:
+#ifndef IOTHUB_STATIC_CONFIG
     static MapUtil *CreateMap();
+#endif
     MapUtil(MAP_HANDLE handle, bool isOwned = false);
     MapUtil(const MapUtil &other);
     ~MapUtil();
 
     MAP_HANDLE GetHandle() const { return _handle; }
+    void Reset(MAP_HANDLE handle, bool isOwned = false);
     MAP_RESULT Add(const char *key, const char *value);
     MAP_RESULT AddOrUpdate(const char *key, const char *value);
     bool ContainsKey(const char *key) const;
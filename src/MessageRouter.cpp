@@ -0,0 +1,187 @@
+#include <algorithm>
+#include <cstring>
+
+#include "MessageRouter.h"
+
+MessageRouter::MessageRouter(IoTHubDevice &iotHubDevice) :
+    _iotHubDevice(iotHubDevice),
+    _indexBuilt(false)
+{
+    _iotHubDevice.SetMessageCallback(Dispatch, this);
+}
+
+MessageRouter::~MessageRouter()
+{
+    // Leaves alone a callback the application has set since
+    if (_iotHubDevice.GetMessageCallback() == Dispatch && _iotHubDevice.GetMessageCallbackContext() == this)
+    {
+        _iotHubDevice.SetMessageCallback(NULL);
+    }
+}
+
+int MessageRouter::AddRoute(const char *propertyName, const char *propertyValue, IoTHubDevice::MessageCallback messageCallback, void *userContext, const char *contentType)
+{
+    int result = 0;
+
+    if (messageCallback == NULL || (propertyName == NULL) != (propertyValue == NULL) || (propertyName == NULL && contentType == NULL))
+    {
+        LogError("A route requires a callback and a property name and value, a content type or both");
+        result = __FAILURE__;
+    }
+    else if (_routes.size() >= _routes.max_size())
+    {
+        LogError("Unable to add route for %s", (propertyName != NULL) ? propertyName : contentType);
+        result = __FAILURE__;
+    }
+    else
+    {
+        _routes.push_back(Route(propertyName, propertyValue, contentType, messageCallback, userContext));
+        _indexBuilt = false;
+    }
+
+    return result;
+}
+
+int MessageRouter::AddContentTypeRoute(const char *contentType, IoTHubDevice::MessageCallback messageCallback, void *userContext)
+{
+    return AddRoute(NULL, NULL, messageCallback, userContext, contentType);
+}
+
+void MessageRouter::SetDefaultRoute(IoTHubDevice::MessageCallback messageCallback, void *userContext)
+{
+    _defaultRoute.messageCallback = messageCallback;
+    _defaultRoute.userContext = userContext;
+}
+
+void MessageRouter::Build()
+{
+    _index.clear();
+    _contentTypeRoutes.clear();
+
+    for (size_t i = 0; i < _routes.size(); i++)
+    {
+        if (_routes[i].propertyName != NULL)
+        {
+            IndexEntry entry = { _routes[i].propertyName, _routes[i].propertyValue, i };
+
+            _index.push_back(entry);
+        }
+        else
+        {
+            _contentTypeRoutes.push_back(i);
+        }
+    }
+
+    if (_index.size() != 0)
+    {
+        std::sort(&_index[0], &_index[0] + _index.size(), IndexEntryLess);
+    }
+
+    _indexBuilt = true;
+}
+
+MessageRouter::Route *MessageRouter::Match(const IoTHubMessage &iotHubMessage)
+{
+    const char *contentType = iotHubMessage.GetContentTypeSystemProperty();
+    MAP_HANDLE properties = IoTHubMessage_Properties(iotHubMessage.GetHandle());
+    const char *const *keys = NULL;
+    const char *const *values = NULL;
+    size_t count = 0;
+    size_t best = _routes.size();
+
+    if (!_indexBuilt)
+    {
+        Build();
+    }
+
+    if (properties == NULL || Map_GetInternals(properties, &keys, &values, &count) != MAP_OK)
+    {
+        count = 0;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        // Entries for the same pair are in route order so the first whose content type fits is the best for this property
+        for (size_t j = FindFirstIndexEntry(keys[i], values[i]); j < _index.size() && _index[j].route < best && Compare(_index[j], keys[i], values[i]) == 0; j++)
+        {
+            if (ContentTypeMatches(_routes[_index[j].route], contentType))
+            {
+                best = _index[j].route;
+                break;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < _contentTypeRoutes.size() && _contentTypeRoutes[i] < best; i++)
+    {
+        if (ContentTypeMatches(_routes[_contentTypeRoutes[i]], contentType))
+        {
+            best = _contentTypeRoutes[i];
+        }
+    }
+
+    return (best < _routes.size()) ? &_routes[best] : &_defaultRoute;
+}
+
+bool MessageRouter::ContentTypeMatches(const Route &route, const char *contentType)
+{
+    return route.contentType == NULL || (contentType != NULL && strcmp(route.contentType, contentType) == 0);
+}
+
+// Binary search for the first entry not less than the name and value
+size_t MessageRouter::FindFirstIndexEntry(const char *propertyName, const char *propertyValue)
+{
+    size_t low = 0;
+    size_t high = _index.size();
+
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+
+        if (Compare(_index[middle], propertyName, propertyValue) < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+int MessageRouter::Compare(const IndexEntry &entry, const char *propertyName, const char *propertyValue)
+{
+    int result = strcmp(entry.propertyName, propertyName);
+
+    if (result == 0)
+    {
+        result = strcmp(entry.propertyValue, propertyValue);
+    }
+
+    return result;
+}
+
+bool MessageRouter::IndexEntryLess(const IndexEntry &left, const IndexEntry &right)
+{
+    int result = Compare(left, right.propertyName, right.propertyValue);
+
+    return result < 0 || (result == 0 && left.route < right.route);
+}
+
+IOTHUBMESSAGE_DISPOSITION_RESULT MessageRouter::Dispatch(IoTHubDevice &iotHubDevice, IoTHubMessage &iotHubMessage, void *userContext)
+{
+    MessageRouter *that = (MessageRouter *)userContext;
+    Route *route = that->Match(iotHubMessage);
+    IOTHUBMESSAGE_DISPOSITION_RESULT result = IOTHUBMESSAGE_REJECTED;
+
+    route->count++;
+
+    if (route->messageCallback != NULL)
+    {
+        result = route->messageCallback(iotHubDevice, iotHubMessage, route->userContext);
+    }
+
+    return result;
+}
@@ -0,0 +1,80 @@
+#ifndef _MESSAGEROUTER_H
+#define _MESSAGEROUTER_H
+
+#include "IoTHubConfig.h"
+#include "IoTHubDevice.h"
+
+// Takes over IoTHubDevice's message callback and passes each cloud to device message to the handler for
+// the first matching route. A route matches on an application property name and value, the content type,
+// or both. Routes are tried in the order they were added. Messages that match no route go to the
+// default route, or are rejected if there is none. Destroying the router clears the message callback
+// unless something else has been set since.
+//
+// The routes are sorted into an index on the first message after a route is added. Each message then
+// needs one pass over its properties, with a binary search of the index for each.
+//
+// Names, values and content types are not copied so they must remain valid, normally string literals:
+//
+// router.AddRoute("type", "reboot", rebootCallback);
+// router.AddRoute("type", "config", configCallback, NULL, "application/json");
+// router.SetDefaultRoute(messageCallback);
+class MessageRouter
+{
+private:
+    struct Route
+    {
+        const char *propertyName;
+        const char *propertyValue;
+        const char *contentType;
+        IoTHubDevice::MessageCallback messageCallback;
+        void *userContext;
+        unsigned long count;
+        Route(const char *propertyName = NULL, const char *propertyValue = NULL, const char *contentType = NULL, IoTHubDevice::MessageCallback messageCallback = NULL, void *userContext = NULL) :
+            propertyName(propertyName), propertyValue(propertyValue), contentType(contentType), messageCallback(messageCallback), userContext(userContext), count(0)
+        {
+        }
+    };
+
+    // Route numbers sorted by property name then value then route number
+    struct IndexEntry
+    {
+        const char *propertyName;
+        const char *propertyValue;
+        size_t route;
+    };
+
+    IoTHubDevice &_iotHubDevice;
+    IoTHubVector<Route, IOTHUB_MAX_ROUTES> _routes;
+    IoTHubVector<IndexEntry, IOTHUB_MAX_ROUTES> _index;
+    IoTHubVector<size_t, IOTHUB_MAX_ROUTES> _contentTypeRoutes;
+    bool _indexBuilt;
+    Route _defaultRoute;
+
+    MessageRouter(const MessageRouter &other);
+    MessageRouter &operator=(const MessageRouter &other);
+
+public:
+    MessageRouter(IoTHubDevice &iotHubDevice);
+    ~MessageRouter();
+
+    int AddRoute(const char *propertyName, const char *propertyValue, IoTHubDevice::MessageCallback messageCallback, void *userContext = NULL, const char *contentType = NULL);
+    int AddContentTypeRoute(const char *contentType, IoTHubDevice::MessageCallback messageCallback, void *userContext = NULL);
+    void SetDefaultRoute(IoTHubDevice::MessageCallback messageCallback, void *userContext = NULL);
+    void Build();
+
+    // Routes are numbered from zero in the order they were added
+    size_t GetRouteCount() { return _routes.size(); }
+    unsigned long GetRouteMessageCount(size_t route) { return (route < _routes.size()) ? _routes[route].count : 0; }
+    unsigned long GetDefaultRouteMessageCount() { return _defaultRoute.count; }
+
+private:
+    Route *Match(const IoTHubMessage &iotHubMessage);
+    bool ContentTypeMatches(const Route &route, const char *contentType);
+    size_t FindFirstIndexEntry(const char *propertyName, const char *propertyValue);
+
+    static int Compare(const IndexEntry &entry, const char *propertyName, const char *propertyValue);
+    static bool IndexEntryLess(const IndexEntry &left, const IndexEntry &right);
+    static IOTHUBMESSAGE_DISPOSITION_RESULT Dispatch(IoTHubDevice &iotHubDevice, IoTHubMessage &iotHubMessage, void *userContext);
+};
+
+#endif // _MESSAGEROUTER_H
@@ -0,0 +1,453 @@
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <climits>
+
+#include "TelemetryAggregator.h"
+
+#include <parson.h>
+
+using namespace std;
+
+TelemetryAggregator::TelemetryAggregator(IoTHubDevice &iotHubDevice, unsigned int windowLength, unsigned int hopLength) :
+    _iotHubDevice(iotHubDevice),
+    _tickCounter(tickcounter_create()),
+    _windowLength(0),
+    _hopLength(0),
+    _paneCount(1),
+    _currentPane(0),
+    _hopStart(0),
+    _eventConfirmationCallback(NULL),
+    _eventConfirmationCallbackUC(NULL),
+    _sampleCount(0),
+    _suppressedCount(0),
+    _recordCount(0)
+{
+    if (_tickCounter == NULL)
+    {
+        LogError("Failed to create tick counter");
+    }
+
+    SetWindow(windowLength, hopLength);
+
+    if (_windowLength == 0)
+    {
+        SetWindow(DefaultWindowLength);
+    }
+}
+
+TelemetryAggregator::~TelemetryAggregator()
+{
+    if (_tickCounter != NULL)
+    {
+        tickcounter_destroy(_tickCounter);
+    }
+}
+
+int TelemetryAggregator::AddSignal(const char *name, double deadband)
+{
+    int result = 0;
+
+    if (name == NULL)
+    {
+        LogError("Signal name must be provided");
+        result = __FAILURE__;
+    }
+    else if (FindSignal(name) != NULL)
+    {
+        result = SetDeadband(name, deadband);
+    }
+    else if (_signals.size() >= _signals.max_size() || !IOTHUB_NAME_FITS(name))
+    {
+        LogError("Unable to add signal %s", name);
+        result = __FAILURE__;
+    }
+    else
+    {
+        _signals.push_back(Signal(name, fabs(deadband)));
+    }
+
+    return result;
+}
+
+int TelemetryAggregator::SetDeadband(const char *name, double deadband)
+{
+    int result = 0;
+    Signal *signal = FindSignal(name);
+
+    if (signal == NULL)
+    {
+        LogError("Unknown signal %s", name);
+        result = __FAILURE__;
+    }
+    else
+    {
+        signal->deadband = fabs(deadband);
+    }
+
+    return result;
+}
+
+int TelemetryAggregator::AddSample(const char *name, double value)
+{
+    int result = 0;
+    Signal *signal = FindSignal(name);
+
+    // Signals are registered on first use with no deadband
+    if (signal == NULL && (result = AddSignal(name)) == 0)
+    {
+        signal = &_signals.back();
+    }
+
+    if (signal != NULL)
+    {
+        Pane &pane = signal->panes[_currentPane];
+
+        _sampleCount++;
+
+        // Every sample is summarised, the deadband only decides whether it is worth sending a record for
+        if (pane.count == 0 || value < pane.min)
+            pane.min = value;
+        if (pane.count == 0 || value > pane.max)
+            pane.max = value;
+
+        pane.sum += value;
+        pane.last = value;
+        pane.count++;
+
+        if (signal->hasLastAccepted && fabs(value - signal->lastAccepted) < signal->deadband)
+        {
+            _suppressedCount++;
+        }
+        else
+        {
+            pane.changed = true;
+            signal->lastAccepted = value;
+            signal->hasLastAccepted = true;
+        }
+    }
+
+    return result;
+}
+
+void TelemetryAggregator::SetWindow(unsigned int windowLength, unsigned int hopLength)
+{
+    if (windowLength == 0)
+    {
+        LogError("Window length must be greater than zero - window not changed");
+    }
+    else
+    {
+        if (hopLength == 0 || hopLength > windowLength)
+        {
+            hopLength = windowLength;
+        }
+
+        size_t paneCount = windowLength / hopLength;
+
+        if (paneCount > MaxPanes)
+        {
+            LogError("Window may contain at most %d hops - hop length increased", (int)MaxPanes);
+            hopLength = (windowLength + MaxPanes - 1) / MaxPanes;
+            paneCount = windowLength / hopLength;
+        }
+
+        // Setting the same window again keeps what has been collected so far
+        if (windowLength != _windowLength || hopLength != _hopLength || paneCount != _paneCount)
+        {
+            _windowLength = windowLength;
+            _hopLength = hopLength;
+            _paneCount = paneCount;
+            _hopStart = GetTickCount();
+
+            // Partially filled windows are discarded rather than summarised against the wrong length
+            ClearPanes();
+        }
+    }
+}
+
+IoTHubDevice::EventConfirmationCallback TelemetryAggregator::SetEventConfirmationCallback(IoTHubDevice::EventConfirmationCallback eventConfirmationCallback, void *userContext)
+{
+    IoTHubDevice::EventConfirmationCallback temp = _eventConfirmationCallback;
+    _eventConfirmationCallback = eventConfirmationCallback;
+    _eventConfirmationCallbackUC = userContext;
+
+    return temp;
+}
+
+int TelemetryAggregator::ApplyDeviceTwin(DEVICE_TWIN_UPDATE_STATE updateState, const char *payLoad)
+{
+    int result = 0;
+    JSON_Value *rootValue = json_parse_string(payLoad);
+    JSON_Object *aggregation;
+
+    if (rootValue == NULL)
+    {
+        LogError("Failed to parse device twin");
+        result = __FAILURE__;
+    }
+    else
+    {
+        // A complete twin has the desired properties one level down
+        aggregation = json_object_dotget_object(json_value_get_object(rootValue),
+            (updateState == DEVICE_TWIN_UPDATE_COMPLETE) ? "desired.aggregation" : "aggregation");
+
+        if (aggregation != NULL)
+        {
+            JSON_Object *deadbands = json_object_get_object(aggregation, "deadbands");
+
+            if (json_object_has_value_of_type(aggregation, "windowSeconds", JSONNumber) ||
+                json_object_has_value_of_type(aggregation, "hopSeconds", JSONNumber))
+            {
+                double windowSeconds = json_object_has_value_of_type(aggregation, "windowSeconds", JSONNumber)
+                    ? json_object_get_number(aggregation, "windowSeconds")
+                    : _windowLength / 1000.0;
+
+                // Without a hop a tumbling window stays tumbling and a sliding window keeps its hop
+                double hopSeconds = json_object_has_value_of_type(aggregation, "hopSeconds", JSONNumber)
+                    ? json_object_get_number(aggregation, "hopSeconds")
+                    : ((_hopLength == _windowLength) ? windowSeconds : _hopLength / 1000.0);
+
+                if (!IsValidSeconds(windowSeconds) || !IsValidSeconds(hopSeconds))
+                {
+                    LogError("Invalid aggregation window %g seconds with hop %g seconds - window not changed", windowSeconds, hopSeconds);
+                    result = __FAILURE__;
+                }
+                else
+                {
+                    SetWindow((unsigned int)(windowSeconds * 1000), (unsigned int)(hopSeconds * 1000));
+                }
+            }
+
+            if (deadbands != NULL)
+            {
+                for (size_t i = 0; i < json_object_get_count(deadbands); i++)
+                {
+                    JSON_Value *deadband = json_object_get_value_at(deadbands, i);
+
+                    if (json_value_get_type(deadband) == JSONNumber)
+                    {
+                        AddSignal(json_object_get_name(deadbands, i), json_value_get_number(deadband));
+                    }
+                }
+            }
+        }
+
+        json_value_free(rootValue);
+    }
+
+    return result;
+}
+
+void TelemetryAggregator::DoWork()
+{
+    tickcounter_ms_t now = GetTickCount();
+
+    if (now - _hopStart >= (tickcounter_ms_t)_hopLength * (_paneCount + 1))
+    {
+        // DoWork has not been called for more than a window - send what was collected and start afresh
+        CloseHop();
+        ClearPanes();
+        _hopStart = now;
+    }
+
+    while (now - _hopStart >= _hopLength)
+    {
+        CloseHop();
+        _hopStart += _hopLength;
+    }
+}
+
+TelemetryAggregator::Signal *TelemetryAggregator::FindSignal(const char *name)
+{
+    Signal *result = NULL;
+
+    for (size_t i = 0; i < _signals.size() && result == NULL; i++)
+    {
+        if (_signals[i].name == name)
+        {
+            result = &_signals[i];
+        }
+    }
+
+    return result;
+}
+
+// Window and hop lengths from the twin must be positive and fit in unsigned int milliseconds
+bool TelemetryAggregator::IsValidSeconds(double seconds)
+{
+    return isfinite(seconds) && seconds > 0 && seconds <= UINT_MAX / 1000;
+}
+
+tickcounter_ms_t TelemetryAggregator::GetTickCount()
+{
+    tickcounter_ms_t result = 0;
+
+    if (_tickCounter == NULL || tickcounter_get_current_ms(_tickCounter, &result) != 0)
+    {
+        LogError("Failed to read tick counter");
+    }
+
+    return result;
+}
+
+void TelemetryAggregator::ClearPanes()
+{
+    for (size_t i = 0; i < _signals.size(); i++)
+    {
+        for (size_t j = 0; j < MaxPanes; j++)
+        {
+            _signals[i].panes[j] = Pane();
+        }
+    }
+
+    _currentPane = 0;
+}
+
+void TelemetryAggregator::CloseHop()
+{
+    bool hasChanged = false;
+
+    for (size_t i = 0; i < _signals.size() && !hasChanged; i++)
+    {
+        hasChanged = _signals[i].panes[_currentPane].changed;
+    }
+
+    // Nothing is sent for a hop in which every signal stayed within its deadband
+    if (hasChanged)
+    {
+        time_t now = get_time(NULL);
+#ifdef IOTHUB_STATIC_CONFIG
+        char record[IOTHUB_MAX_RECORD_SIZE];
+
+        if (BuildRecord(record, sizeof(record), now) >= sizeof(record))
+        {
+            LogError("Aggregate record exceeds IOTHUB_MAX_RECORD_SIZE");
+        }
+        else
+        {
+            SendRecord(record);
+        }
+#else
+        std::string record;
+
+        record.resize(BuildRecord(NULL, 0, now) + 1);
+        record.resize(BuildRecord(&record[0], record.size(), now));
+        SendRecord(record.c_str());
+#endif
+    }
+
+    _currentPane = (_currentPane + 1) % _paneCount;
+
+    for (size_t i = 0; i < _signals.size(); i++)
+    {
+        _signals[i].panes[_currentPane] = Pane();
+    }
+}
+
+void TelemetryAggregator::SendRecord(const char *record)
+{
+    IoTHubMessage message(record);
+
+    message.SetContentTypeSystemProperty("application/json");
+
+    if (_iotHubDevice.SendEventAsync(&message, _eventConfirmationCallback, _eventConfirmationCallbackUC) != IOTHUB_CLIENT_OK)
+    {
+        LogError("Failed to send aggregate record");
+    }
+    else
+    {
+        _recordCount++;
+    }
+}
+
+// Returns the length of the whole record, which may be more than was written if the buffer is too small
+size_t TelemetryAggregator::BuildRecord(char *buffer, size_t size, time_t now)
+{
+    size_t length = 0;
+    char text[160];
+
+    if (size != 0)
+    {
+        buffer[0] = '\0';
+    }
+
+    // When the window is not a whole number of hops it is the panes actually summarised that are reported
+    snprintf(text, sizeof(text), "{\"time\":%ld,\"windowSeconds\":%g", (long)now, _paneCount * _hopLength / 1000.0);
+    AppendText(buffer, size, length, text);
+
+    for (size_t i = 0; i < _signals.size(); i++)
+    {
+        Signal &signal = _signals[i];
+        Pane window;
+
+        // Panes are visited oldest first so that last ends up as the most recent value
+        for (size_t j = 1; j <= _paneCount; j++)
+        {
+            Pane &pane = signal.panes[(_currentPane + j) % _paneCount];
+
+            if (pane.count != 0)
+            {
+                if (window.count == 0 || pane.min < window.min)
+                    window.min = pane.min;
+                if (window.count == 0 || pane.max > window.max)
+                    window.max = pane.max;
+
+                window.sum += pane.sum;
+                window.last = pane.last;
+                window.count += pane.count;
+            }
+        }
+
+        if (window.count != 0)
+        {
+            snprintf(text, sizeof(text), ":{\"min\":%g,\"max\":%g,\"mean\":%g,\"count\":%u,\"last\":%g}",
+                window.min, window.max, window.sum / window.count, window.count, window.last);
+
+            AppendText(buffer, size, length, ",");
+            AppendJsonString(buffer, size, length, signal.name.c_str());
+            AppendText(buffer, size, length, text);
+        }
+    }
+
+    AppendText(buffer, size, length, "}");
+
+    return length;
+}
+
+// Appends value as a quoted JSON string. Signal names can come from the device twin so may need escaping.
+void TelemetryAggregator::AppendJsonString(char *buffer, size_t size, size_t &length, const char *value)
+{
+    AppendText(buffer, size, length, "\"");
+
+    for (const char *c = value; *c != '\0'; c++)
+    {
+        char escaped[7] = { *c, '\0' };
+
+        if (*c == '"' || *c == '\\')
+        {
+            snprintf(escaped, sizeof(escaped), "\\%c", *c);
+        }
+        else if ((unsigned char)*c < 0x20)
+        {
+            snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)*c);
+        }
+
+        AppendText(buffer, size, length, escaped);
+    }
+
+    AppendText(buffer, size, length, "\"");
+}
+
+// Appends as much of text as fits, keeping the buffer terminated, and counts all of it
+void TelemetryAggregator::AppendText(char *buffer, size_t size, size_t &length, const char *text)
+{
+    for (; *text != '\0'; text++, length++)
+    {
+        if (length + 1 < size)
+        {
+            buffer[length] = *text;
+            buffer[length + 1] = '\0';
+        }
+    }
+}
@@ -0,0 +1,105 @@
+#ifndef _TELEMETRYAGGREGATOR_H
+#define _TELEMETRYAGGREGATOR_H
+
+#include "IoTHubConfig.h"
+#include "IoTHubDevice.h"
+
+#include "azure_c_shared_utility/tickcounter.h"
+
+// Sits in front of IoTHubDevice::SendEventAsync. Samples are summarised into tumbling (hop == window) or
+// sliding (hop < window) windows. One record is sent per hop containing min, max, mean, count and last for
+// every signal that had samples in the window. Every sample counts towards these; a per signal deadband
+// only suppresses the record for a hop in which no signal moved by at least its deadband.
+//
+// The window, hop and deadbands can be set from the device twin by passing the twin payload to
+// ApplyDeviceTwin from the DeviceTwinCallback. The expected layout is:
+//
+// "aggregation": { "windowSeconds": 60, "hopSeconds": 60, "deadbands": { "temperature": 0.5 } }
+//
+// A missing hopSeconds keeps the current hop, or keeps a tumbling window tumbling. Partially filled windows
+// are only discarded when the window or hop actually changes. Records carry the window actually covered,
+// which is a whole number of hops and so may differ from the one requested.
+class TelemetryAggregator
+{
+public:
+#ifdef IOTHUB_STATIC_CONFIG
+    static const size_t MaxPanes = IOTHUB_MAX_PANES;
+#else
+    static const size_t MaxPanes = 16;
+#endif
+
+private:
+    struct Pane
+    {
+        double min;
+        double max;
+        double sum;
+        double last;
+        unsigned int count;
+        bool changed;
+        Pane() : min(0), max(0), sum(0), last(0), count(0), changed(false) {}
+    };
+
+    struct Signal
+    {
+        IoTHubString name;
+        double deadband;
+        double lastAccepted;
+        bool hasLastAccepted;
+        Pane panes[MaxPanes];
+        Signal(const char *name = "", double deadband = 0) :
+            name(name), deadband(deadband), lastAccepted(0), hasLastAccepted(false)
+        {
+        }
+    };
+
+    static const unsigned int DefaultWindowLength = 60000;
+
+    IoTHubDevice &_iotHubDevice;
+    TICK_COUNTER_HANDLE _tickCounter;
+    IoTHubVector<Signal, IOTHUB_MAX_PROPERTIES> _signals;
+    unsigned int _windowLength;
+    unsigned int _hopLength;
+    size_t _paneCount;
+    size_t _currentPane;
+    tickcounter_ms_t _hopStart;
+
+    IoTHubDevice::EventConfirmationCallback _eventConfirmationCallback;
+    void *_eventConfirmationCallbackUC;
+
+    unsigned long _sampleCount;
+    unsigned long _suppressedCount;
+    unsigned long _recordCount;
+
+public:
+    TelemetryAggregator(IoTHubDevice &iotHubDevice, unsigned int windowLength = 60000, unsigned int hopLength = 0);
+    ~TelemetryAggregator();
+
+    int AddSignal(const char *name, double deadband = 0);
+    int SetDeadband(const char *name, double deadband);
+    int AddSample(const char *name, double value);
+    void SetWindow(unsigned int windowLength, unsigned int hopLength = 0);
+    unsigned int GetWindowLength() { return _windowLength; }
+    unsigned int GetHopLength() { return _hopLength; }
+    IoTHubDevice::EventConfirmationCallback SetEventConfirmationCallback(IoTHubDevice::EventConfirmationCallback eventConfirmationCallback, void *userContext = NULL);
+    int ApplyDeviceTwin(DEVICE_TWIN_UPDATE_STATE updateState, const char *payLoad);
+
+    unsigned long GetSampleCount() { return _sampleCount; }
+    unsigned long GetSuppressedCount() { return _suppressedCount; }
+    unsigned long GetRecordCount() { return _recordCount; }
+
+    void DoWork();
+
+private:
+    Signal *FindSignal(const char *name);
+    static bool IsValidSeconds(double seconds);
+    tickcounter_ms_t GetTickCount();
+    void ClearPanes();
+    void CloseHop();
+    void SendRecord(const char *record);
+    size_t BuildRecord(char *buffer, size_t size, time_t now);
+    static void AppendJsonString(char *buffer, size_t size, size_t &length, const char *value);
+    static void AppendText(char *buffer, size_t size, size_t &length, const char *text);
+};
+
+#endif // _TELEMETRYAGGREGATOR_H
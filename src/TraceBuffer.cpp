@@ -0,0 +1,192 @@
+#include <cstdlib>
+
+#include "TraceBuffer.h"
+#include "IoTHubDevice.h"
+
+// Returns true if the buffer already held records, for example from before a reset
+bool TraceBuffer::Begin()
+{
+    bool result = _magic == Magic && Count() != 0;
+
+    if (_magic != Magic)
+    {
+        Clear();
+        _magic = Magic;
+    }
+
+    return result;
+}
+
+void TraceBuffer::Clear()
+{
+    _next.store(0);
+
+    for (size_t i = 0; i < Capacity; i++)
+    {
+        _slots[i].sequence.store(0, std::memory_order_relaxed);
+    }
+}
+
+void TraceBuffer::Add(uint32_t timestamp, uint32_t event, int32_t arg0, int32_t arg1, int32_t arg2)
+{
+    uint32_t sequence = _next.fetch_add(1, std::memory_order_relaxed) + 1;
+
+    // Zero is never used as it marks an empty slot. Capacity divides 2^32 so the slots stay in order.
+    if (sequence == 0)
+    {
+        sequence = _next.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    Slot &slot = _slots[sequence % Capacity];
+
+    // Zero marks a record that is empty or part written. The fence keeps it ahead of the fields.
+    slot.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.timestamp.store(timestamp, std::memory_order_relaxed);
+    slot.event.store(event, std::memory_order_relaxed);
+    slot.args[0].store(arg0, std::memory_order_relaxed);
+    slot.args[1].store(arg1, std::memory_order_relaxed);
+    slot.args[2].store(arg2, std::memory_order_relaxed);
+    slot.sequence.store(sequence, std::memory_order_release);
+}
+
+// Counts the slots holding one of the last Capacity records, which stays right when the sequence wraps
+size_t TraceBuffer::Count() const
+{
+    uint32_t next = _next.load();
+    size_t result = 0;
+
+    for (size_t i = 0; i < Capacity; i++)
+    {
+        uint32_t sequence = _slots[i].sequence.load(std::memory_order_relaxed);
+
+        if (sequence != 0 && next - sequence < Capacity)
+        {
+            result++;
+        }
+    }
+
+    return result;
+}
+
+void TraceBuffer::Dump(Writer writer, void *userContext) const
+{
+    uint32_t next = _next.load();
+    char text[RecordTextLength + 2];
+
+    writer(GetHeader(), userContext);
+    writer("\n", userContext);
+
+    for (uint32_t sequence = next - Capacity + 1; sequence != next + 1; sequence++)
+    {
+        Record record;
+
+        if (ReadRecord(sequence, record))
+        {
+            FormatRecord(record, text);
+            text[RecordTextLength] = '\n';
+            text[RecordTextLength + 1] = '\0';
+            writer(text, userContext);
+        }
+    }
+}
+
+// Returns the length written or -1 if the buffer is too small - GetFormattedSize is always enough
+int TraceBuffer::Format(char *buffer, size_t size) const
+{
+    uint32_t next = _next.load();
+    size_t length = strlen(GetHeader());
+    int result = -1;
+
+    if (size > length)
+    {
+        memcpy(buffer, GetHeader(), length);
+
+        for (uint32_t sequence = next - Capacity + 1; sequence != next + 1 && length + RecordTextLength < size; sequence++)
+        {
+            Record record;
+
+            if (ReadRecord(sequence, record))
+            {
+                FormatRecord(record, buffer + length);
+                length += RecordTextLength;
+            }
+        }
+
+        buffer[length] = '\0';
+        result = (int)length;
+    }
+
+    return result;
+}
+
+// Fails if the record has been, or is being, overwritten by a newer one
+bool TraceBuffer::ReadRecord(uint32_t sequence, Record &record) const
+{
+    const Slot &slot = _slots[sequence % Capacity];
+    bool result = false;
+
+    if (sequence != 0 && slot.sequence.load(std::memory_order_acquire) == sequence)
+    {
+        record.sequence = sequence;
+        record.timestamp = slot.timestamp.load(std::memory_order_relaxed);
+        record.event = slot.event.load(std::memory_order_relaxed);
+        record.args[0] = slot.args[0].load(std::memory_order_relaxed);
+        record.args[1] = slot.args[1].load(std::memory_order_relaxed);
+        record.args[2] = slot.args[2].load(std::memory_order_relaxed);
+
+        // Keeps the second look at sequence after the fields
+        std::atomic_thread_fence(std::memory_order_acquire);
+        result = slot.sequence.load(std::memory_order_relaxed) == sequence;
+    }
+
+    return result;
+}
+
+// Little endian regardless of the device so the decoder need not know where the trace came from
+void TraceBuffer::FormatRecord(const Record &record, char *text)
+{
+    static const char hex[] = "0123456789abcdef";
+    uint32_t words[6] = { record.sequence, record.timestamp, record.event, (uint32_t)record.args[0], (uint32_t)record.args[1], (uint32_t)record.args[2] };
+
+    for (int i = 0; i < 6; i++)
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            uint8_t byte = (uint8_t)(words[i] >> (j * 8));
+
+            *text++ = hex[byte >> 4];
+            *text++ = hex[byte & 0x0f];
+        }
+    }
+}
+
+int TraceBuffer::DeviceMethodCallback(IoTHubDevice &iotHubDevice, const unsigned char *payload, size_t size, unsigned char **response, size_t *resp_size, void *userContext)
+{
+    TraceBuffer *that = (TraceBuffer *)userContext;
+    static const char prefix[] = "{\"trace\":\"";
+    static const char suffix[] = "\"}";
+    size_t bufferSize = sizeof(prefix) - 1 + that->GetFormattedSize() + sizeof(suffix) - 1;
+    int status = 200;
+    int length;
+
+    // The SDK frees the response
+    if ((*response = (unsigned char *)malloc(bufferSize)) == NULL)
+    {
+        status = -1;
+    }
+    else if ((length = that->Format((char *)*response + sizeof(prefix) - 1, bufferSize - (sizeof(prefix) - 1) - (sizeof(suffix) - 1))) < 0)
+    {
+        free(*response);
+        *response = NULL;
+        status = -1;
+    }
+    else
+    {
+        memcpy(*response, prefix, sizeof(prefix) - 1);
+        memcpy(*response + sizeof(prefix) - 1 + length, suffix, sizeof(suffix) - 1);
+        *resp_size = sizeof(prefix) - 1 + length + sizeof(suffix) - 1;
+    }
+
+    return status;
+}
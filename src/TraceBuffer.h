@@ -0,0 +1,66 @@
+#ifndef _TRACEBUFFER_H
+#define _TRACEBUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "IoTHubConfig.h"
+#include "TraceFormat.h"
+
+class IoTHubDevice;
+
+// Fixed size ring of compact binary trace records, a cheap alternative to the SDK's serial logging that
+// can be left on all the time. Passed to IoTHubDevice::SetTraceBuffer it records sends, confirmations,
+// callbacks, DoWork calls that took time and connection status changes. Adding a record takes no lock,
+// so records may also be added from other tasks.
+//
+// The class has no constructor so that on the ESP32 a buffer declared with __NOINIT_ATTR keeps its
+// records over a panic or watchdog reset and can be dumped after the restart. Begin must be called once
+// before use, which SetTraceBuffer does.
+//
+// Dump and Format write the records as text (see TraceFormat.h) that extras/host/trace_decode turns back
+// into a readable listing. It can also be read from the hub by registering DeviceMethodCallback as a
+// device method.
+class TraceBuffer : public TraceFormat
+{
+public:
+    static const uint32_t Magic = 0x45435254;
+    static const size_t Capacity = IOTHUB_TRACE_RECORDS;
+
+    static_assert(Capacity != 0 && (Capacity & (Capacity - 1)) == 0, "IOTHUB_TRACE_RECORDS must be a power of two");
+
+    typedef void (*Writer)(const char *text, void *userContext);
+
+private:
+    // A Record as stored. Readers copy the fields out and then check that sequence has not changed.
+    struct Slot
+    {
+        std::atomic<uint32_t> sequence;     // Zero while the record is being written
+        std::atomic<uint32_t> timestamp;
+        std::atomic<uint32_t> event;
+        std::atomic<int32_t> args[3];
+    };
+
+    uint32_t _magic;
+    std::atomic<uint32_t> _next;
+    Slot _slots[Capacity];
+
+    bool ReadRecord(uint32_t sequence, Record &record) const;
+    static void FormatRecord(const Record &record, char *text);
+
+public:
+    bool Begin();
+    void Clear();
+    void Add(uint32_t timestamp, uint32_t event, int32_t arg0 = 0, int32_t arg1 = 0, int32_t arg2 = 0);
+    size_t Count() const;
+    size_t GetFormattedSize() const { return strlen(GetHeader()) + Count() * RecordTextLength + 1; }
+    void Dump(Writer writer, void *userContext = NULL) const;
+    int Format(char *buffer, size_t size) const;
+
+    // Device method returning { "trace": "<Format output>" }, registered with the buffer as user context
+    static int DeviceMethodCallback(IoTHubDevice &iotHubDevice, const unsigned char *payload, size_t size, unsigned char **response, size_t *resp_size, void *userContext);
+};
+
+#endif // _TRACEBUFFER_H
@@ -0,0 +1,91 @@
+#ifndef _TRACEFORMAT_H
+#define _TRACEFORMAT_H
+
+#include <cstddef>
+#include <cstdint>
+
+// The text format written by TraceBuffer::Dump and TraceBuffer::Format, and the events it records. Kept
+// apart from TraceBuffer, with no dependency on the SDK, so that decoders such as extras/host/trace_decode
+// can be built on their own.
+//
+// A dump is GetHeader() followed by RecordTextLength hex digits per record, oldest first. Each record is
+// the six 32 bit words of Record, in order, each written least significant byte first.
+struct TraceFormat
+{
+    static const size_t RecordTextLength = 48;
+
+    enum Event
+    {
+        Start = 1,                  // Start result
+        Stop,                       // Messages pending, messages in flight
+        Send,                       // Message id, SendEventAsync result, messages pending
+        Submit,                     // Message id, SDK result, messages in flight
+        Confirmation,               // Message id, confirmation result, ms since submitted
+        Discard,                    // Message id, confirmation result
+        DoWork,                     // ms in the SDK's DoWork, messages in flight, messages pending
+        ConnectionStatus,           // Status, reason
+        MessageCallback,            // Disposition, ms in callback
+        MethodCallback,             // Status, payload size, ms in callback
+        TwinCallback,               // Update state, payload size
+        ReportedStateCallback,      // Status code
+        User = 0x100,               // Applications may add their own events from here on
+    };
+
+    struct Record
+    {
+        uint32_t sequence;
+        uint32_t timestamp;         // ms from the device's tick counter
+        uint32_t event;
+        int32_t args[3];
+    };
+
+    static const char *GetHeader() { return "IOTHUBTRACE:1:"; }
+    static const char *GetEventName(uint32_t event);
+    static const char *GetArgumentName(uint32_t event, int index);
+};
+
+inline const char *TraceFormat::GetEventName(uint32_t event)
+{
+    static const char *names[] =
+    {
+        NULL,
+        "Start",
+        "Stop",
+        "Send",
+        "Submit",
+        "Confirmation",
+        "Discard",
+        "DoWork",
+        "ConnectionStatus",
+        "MessageCallback",
+        "MethodCallback",
+        "TwinCallback",
+        "ReportedStateCallback",
+    };
+
+    return (event < sizeof(names) / sizeof(names[0])) ? names[event] : NULL;
+}
+
+inline const char *TraceFormat::GetArgumentName(uint32_t event, int index)
+{
+    static const char *names[][3] =
+    {
+        { NULL, NULL, NULL },
+        { "result", NULL, NULL },
+        { "pending", "inFlight", NULL },
+        { "id", "result", "pending" },
+        { "id", "result", "inFlight" },
+        { "id", "result", "latency" },
+        { "id", "result", NULL },
+        { "duration", "inFlight", "pending" },
+        { "status", "reason", NULL },
+        { "disposition", "duration", NULL },
+        { "status", "size", "duration" },
+        { "state", "size", NULL },
+        { "status", NULL, NULL },
+    };
+
+    return (event < sizeof(names) / sizeof(names[0]) && index >= 0 && index < 3) ? names[event][index] : NULL;
+}
+
+#endif // _TRACEFORMAT_H
@@ -0,0 +1,172 @@
+#include <cstring>
+
+#include "TwinCache.h"
+
+TwinCache::TwinCache() : _fileName(NULL), _twin(NULL)
+{
+}
+
+TwinCache::~TwinCache()
+{
+    if (_twin != NULL)
+        json_value_free(_twin);
+}
+
+bool TwinCache::Load()
+{
+    if (_fileName != NULL && _twin == NULL)
+    {
+        JSON_Value *file = json_parse_file(_fileName);
+        JSON_Object *root = json_value_get_object(file);
+
+        if (root == NULL)
+        {
+            LogInfo("No device twin cache found in %s", _fileName);
+        }
+        else if (json_object_get_number(root, "cacheVersion") != CacheVersion || json_object_get_object(root, "twin") == NULL)
+        {
+            LogError("Ignoring device twin cache %s with unknown format", _fileName);
+        }
+        else
+        {
+            _twin = json_value_deep_copy(json_object_get_value(root, "twin"));
+        }
+
+        if (file != NULL)
+            json_value_free(file);
+    }
+
+    return _twin != NULL;
+}
+
+char *TwinCache::Serialize() const
+{
+    // Caller frees the result with json_free_serialized_string
+    return (_twin != NULL) ? json_serialize_to_string(_twin) : NULL;
+}
+
+bool TwinCache::Update(DEVICE_TWIN_UPDATE_STATE updateState, const char *payLoad)
+{
+    bool result = true;
+    bool modified = false;
+    JSON_Value *update = json_parse_string(payLoad);
+    char *before = Serialize();
+
+    if (json_value_get_object(update) == NULL)
+    {
+        LogError("Failed to parse device twin for cache");
+    }
+    else if (updateState == DEVICE_TWIN_UPDATE_COMPLETE)
+    {
+        // The hub bumps $version on every change so matching versions mean the desired properties are as cached
+        if (_twin != NULL)
+        {
+            double cachedVersion = GetVersion(json_value_get_object(_twin), "desired");
+
+            result = cachedVersion < 0 || cachedVersion != GetVersion(json_value_get_object(update), "desired");
+            json_value_free(_twin);
+        }
+
+        _twin = update;
+        update = NULL;
+        modified = true;
+    }
+    else if (_twin != NULL)
+    {
+        // Partial updates only ever carry desired properties
+        JSON_Object *desired = json_object_get_object(json_value_get_object(_twin), "desired");
+
+        if (desired != NULL)
+        {
+            Merge(desired, json_value_get_object(update));
+            modified = true;
+        }
+    }
+
+    // Every connection brings the twin again, so the file is only rewritten when its content changes
+    if (modified)
+    {
+        char *after = Serialize();
+
+        if (before == NULL || after == NULL || strcmp(before, after) != 0)
+        {
+            Save();
+        }
+
+        if (after != NULL)
+            json_free_serialized_string(after);
+    }
+
+    if (before != NULL)
+        json_free_serialized_string(before);
+
+    if (update != NULL)
+        json_value_free(update);
+
+    return result;
+}
+
+bool TwinCache::Save()
+{
+    bool result = false;
+    JSON_Value *file = json_value_init_object();
+    JSON_Object *root = json_value_get_object(file);
+
+    if (root == NULL)
+    {
+        LogError("Failed to create device twin cache");
+    }
+    else
+    {
+        json_object_set_number(root, "cacheVersion", CacheVersion);
+        json_object_set_value(root, "twin", json_value_deep_copy(_twin));
+
+        if (json_serialize_to_file(file, _fileName) != JSONSuccess)
+        {
+            LogError("Failed to write device twin cache %s", _fileName);
+        }
+        else
+        {
+            result = true;
+        }
+    }
+
+    if (file != NULL)
+        json_value_free(file);
+
+    return result;
+}
+
+// Applies a partial update to the cached desired properties in the same way the hub does - objects are
+// merged, null removes a property and anything else replaces it
+void TwinCache::Merge(JSON_Object *target, JSON_Object *patch)
+{
+    for (size_t i = 0; i < json_object_get_count(patch); i++)
+    {
+        const char *name = json_object_get_name(patch, i);
+        JSON_Value *value = json_object_get_value_at(patch, i);
+        JSON_Object *targetObject = json_object_get_object(target, name);
+
+        if (json_value_get_type(value) == JSONNull)
+        {
+            json_object_remove(target, name);
+        }
+        else if (json_value_get_type(value) == JSONObject && targetObject != NULL)
+        {
+            Merge(targetObject, json_value_get_object(value));
+        }
+        else
+        {
+            json_object_set_value(target, name, json_value_deep_copy(value));
+        }
+    }
+}
+
+double TwinCache::GetVersion(JSON_Object *twin, const char *section)
+{
+    JSON_Object *sectionObject = json_object_get_object(twin, section);
+
+    return json_object_has_value_of_type(sectionObject, "$version", JSONNumber)
+        ? json_object_get_number(sectionObject, "$version")
+        : -1;
+}
@@ -0,0 +1,42 @@
+#ifndef _TWINCACHE_H
+#define _TWINCACHE_H
+
+#include <AzureIoTHub.h>
+#include <parson.h>
+
+// Keeps a copy of the last device twin (desired and reported sections) in a file so that a device can
+// configure itself from it at start up before the hub has been contacted. On the ESP32 the file name
+// should be on a mounted file system, for example "/spiffs/twin.json".
+//
+// The file holds { "cacheVersion": n, "twin": { "desired": { ... }, "reported": { ... } } }. Files with
+// a different cacheVersion are ignored. The file is only rewritten when an update changes the twin.
+class TwinCache
+{
+public:
+    static const int CacheVersion = 1;
+
+private:
+    const char *_fileName;
+    JSON_Value *_twin;
+
+    TwinCache(const TwinCache &other);
+    TwinCache &operator=(const TwinCache &other);
+
+    bool Save();
+    static void Merge(JSON_Object *target, JSON_Object *patch);
+    static double GetVersion(JSON_Object *twin, const char *section);
+
+public:
+    TwinCache();
+    ~TwinCache();
+
+    const char *GetFileName() const { return _fileName; }
+    void SetFileName(const char *fileName) { _fileName = fileName; }
+    bool IsEnabled() const { return _fileName != NULL; }
+    bool IsLoaded() const { return _twin != NULL; }
+    bool Load();
+    char *Serialize() const;
+    bool Update(DEVICE_TWIN_UPDATE_STATE updateState, const char *payLoad);
+};
+
+#endif // _TWINCACHE_H